@@ -0,0 +1,32 @@
+#include <new>
+#include <cstdlib>
+
+#include "Profiler.h"
+
+//the global operator new and delete, replaced so that --alloc-profile can count every
+//allocation. with it off, this is one branch on top of what the standard library's version
+//does. this is only linked into the charm executable, libcharm leaves them alone
+
+void* operator new(std::size_t size) {
+	AllocationProfiler::recordNew(size);
+	void* p = std::malloc(size == 0 ? 1 : size);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+void* operator new[](std::size_t size) {
+	return operator new(size);
+}
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+void operator delete[](void* p) noexcept {
+	std::free(p);
+}
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+void operator delete[](void* p, std::size_t) noexcept {
+	std::free(p);
+}
@@ -1,11 +1,24 @@
 #pragma once
 #include <stdexcept>
 #include <iostream>
+//errors hit while doing work ahead of time (lexing on a worker thread in Parser::prelex, or
+//running builtins while constant folding in FunctionAnalyzer::fold) aren't printed. the work
+//is thrown away and redone in order, which reports the error if there really is one
+inline thread_local bool quietErrors = false;
+static inline bool setQuietErrors(bool quiet) {
+    bool wasQuiet = quietErrors;
+    quietErrors = quiet;
+    return wasQuiet;
+}
 static inline void runtime_die(std::string arg) {
-    std::cout << "[RUNTIME ERROR]: " << arg << std::endl;
+    if (!quietErrors) {
+        std::cout << "[RUNTIME ERROR]: " << arg << std::endl;
+    }
     throw std::runtime_error(arg);
 }
 static inline void parsetime_die(std::string arg) {
-    std::cout << "[PARSE ERROR]: " << arg << std::endl;
+    if (!quietErrors) {
+        std::cout << "[PARSE ERROR]: " << arg << std::endl;
+    }
     throw std::runtime_error(arg);
 }
@@ -1,21 +1,168 @@
 #include <stdexcept>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <string>
 
 #include "FunctionAnalyzer.h"
 #include "ParserTypes.h"
+#include "Parser.h"
+#include "Runner.h"
+#include "PredefinedFunctions.h"
 #include "Error.h"
 #include "Debug.h"
 
 FunctionAnalyzer::FunctionAnalyzer() {
+    //lists compiled against an analyzer remember its address and generation, and another
+    //analyzer can end up at the same address once this one is gone. so every analyzer
+    //starts counting its generations from somewhere no other one will get to
+    static std::atomic<unsigned long long> firstGenerations(0);
+    generation = firstGenerations.fetch_add(1ULL << 32);
+}
+
+void FunctionAnalyzer::replay(const AnalyzerChange& change) {
+    switch (change.kind) {
+        case AnalyzerChange::COUNT_DEFINITION:
+            FunctionAnalyzer::countDefinition(change.name);
+            break;
+        case AnalyzerChange::DEFINITION_BODY:
+            FunctionAnalyzer::addDefinitionBody(change.name, change.body);
+            break;
+        case AnalyzerChange::INLINE_DEFINITION: {
+            CharmFunction f;
+            f.functionType = FUNCTION_DEFINITION;
+            f.functionName = change.name;
+            f.literalFunctions = change.body;
+            FunctionAnalyzer::addToInlineDefinitions(f, change.depth);
+            break;
+        }
+        case AnalyzerChange::TYPE_SIGNATURE:
+            FunctionAnalyzer::addTypeSignature(change.typeSignature);
+            break;
+        case AnalyzerChange::MEMO:
+            FunctionAnalyzer::addMemo(change.name, change.capacity);
+            break;
+    }
 }
 
 void FunctionAnalyzer::addTypeSignature(CharmTypeSignature t) {
-    typeSignatures[t.functionName] = t;
+    if (t.units.size() > MAX_TYPE_SIGNATURE_UNITS) {
+        parsetime_die("Type signature for `" + t.functionName + "` has too many alternatives.");
+    }
+    CompiledTypeSignature compiled;
+    compiled.signature = t;
+    compiled.maxLength = maxTypeSignatureLength(t);
+    compiled.hasPushes = false;
+    for (const CharmTypeSignatureUnit& unit : t.units) {
+        CompiledTypeSignatureUnit compiledUnit;
+        for (CharmTypes type : unit.pops) {
+            compiledUnit.pops.push_back(charmTypeToTypeMask(type));
+        }
+        for (CharmTypes type : unit.pushes) {
+            compiledUnit.pushes.push_back(charmTypeToTypeMask(type));
+            compiled.hasPushes = true;
+        }
+        compiled.units.push_back(compiledUnit);
+    }
+    if (journal) {
+        AnalyzerChange change = { AnalyzerChange::TYPE_SIGNATURE, t.functionName };
+        change.typeSignature = t;
+        journal->push_back(change);
+    }
+    typeSignatures[t.functionName] = compiled;
+    generation++;
 }
 std::optional<CharmTypeSignature> FunctionAnalyzer::getTypeSignature(std::string name) {
     std::optional<CharmTypeSignature> out;
     auto iter = typeSignatures.find(name);
     if (iter != typeSignatures.end()) {
-        out = iter->second;
+        out = iter->second.signature;
+    }
+    return out;
+}
+const CompiledTypeSignature* FunctionAnalyzer::getCompiledTypeSignature(const std::string& name) const {
+    auto iter = typeSignatures.find(name);
+    if (iter != typeSignatures.end()) {
+        return &iter->second;
+    }
+    return nullptr;
+}
+
+std::vector<CharmTypeSignature> FunctionAnalyzer::getTypeSignatures() {
+    std::vector<CharmTypeSignature> out;
+    for (auto& t : typeSignatures) {
+        out.push_back(t.second.signature);
+    }
+    return out;
+}
+
+void FunctionAnalyzer::addMemo(const std::string& name, unsigned long capacity) {
+    auto typeSignature = typeSignatures.find(name);
+    if (typeSignature == typeSignatures.end()) {
+        parsetime_die("`memo " + name + "` needs a type signature for `" + name + "` first, to know what to cache.");
+    }
+    const std::vector<CharmTypeSignatureUnit>& units = typeSignature->second.signature.units;
+    for (const CharmTypeSignatureUnit& unit : units) {
+        if (unit.pops.size() != units[0].pops.size() || unit.pushes.size() != units[0].pushes.size()) {
+            parsetime_die("`memo " + name + "` needs a type signature that always pops and pushes the same number of values.");
+        }
+    }
+    if (definitionCount(name) != 0) {
+        parsetime_die("`memo " + name + "` has to come before the definition of `" + name + "`.");
+    }
+    if (capacity == 0) {
+        parsetime_die("`memo " + name + "` has to be able to cache at least one call.");
+    }
+    if (journal) {
+        AnalyzerChange change = { AnalyzerChange::MEMO, name };
+        change.capacity = capacity;
+        journal->push_back(change);
+    }
+    memos[name] = { name, capacity, (unsigned int)units[0].pops.size(), (unsigned int)units[0].pushes.size() };
+    generation++;
+}
+void FunctionAnalyzer::checkMemo(const std::string& name) {
+    auto memo = memos.find(name);
+    if (memo == memos.end()) {
+        return;
+    }
+    unsigned int e = FunctionAnalyzer::getEffects(name);
+    if (e != 0) {
+        parsetime_die("`" + name + "` can't be memoized, it " + effectsToString(e) + ".");
+    }
+    //the cache is keyed on the values the type signature pops, so the body can't look at
+    //anything under them, and has to leave exactly as many values as it says it pushes
+    StackEffectState state;
+    std::vector<std::string> callers = { name };
+    std::string reason;
+    if (!FunctionAnalyzer::stackEffect(definitions[name].body, state, callers, reason)) {
+        parsetime_die("`" + name + "` can't be memoized, there's no telling what it does to the stack: " + reason + ".");
+    }
+    long pops = memo->second.pops;
+    long pushes = memo->second.pushes;
+    if (-state.lowest > pops || state.height != pushes - pops) {
+        parsetime_die("`" + name + "` can't be memoized, its type signature says it pops " + std::to_string(pops) +
+            " and pushes " + std::to_string(pushes) + ", but its body reaches " + std::to_string(-state.lowest) +
+            " values deep and changes the height of the stack by " + std::to_string(state.height) + ".");
+    }
+}
+std::string FunctionAnalyzer::unlinkedName(const std::string& name) const {
+    if (ns != "" && name.compare(0, ns.size(), ns) == 0) {
+        return name.substr(ns.size());
+    }
+    return name;
+}
+const MemoDeclaration* FunctionAnalyzer::getMemo(const std::string& name) const {
+    auto memo = memos.find(name);
+    if (memo == memos.end()) {
+        return nullptr;
+    }
+    return &memo->second;
+}
+std::vector<MemoDeclaration> FunctionAnalyzer::getMemos() {
+    std::vector<MemoDeclaration> out;
+    for (auto& memo : memos) {
+        out.push_back(memo.second);
     }
     return out;
 }
@@ -34,22 +181,77 @@ unsigned int FunctionAnalyzer::maxTypeSignatureLength(CharmTypeSignature t) {
     return maxLength;
 }
 
-void FunctionAnalyzer::addToInlineDefinitions(CharmFunction f) {
+//how much code there is, counting everything inside of lists too
+static unsigned long codeSize(const CHARM_LIST_TYPE& code) {
+    unsigned long size = 0;
+    for (const CharmFunction& f : code) {
+        size++;
+        if (f.functionType == LIST_FUNCTION) {
+            size += codeSize(f.literalFunctions);
+        }
+    }
+    return size;
+}
+
+void FunctionAnalyzer::addToInlineDefinitions(const CharmFunction& f, unsigned int depth) {
     if (f.functionType == FUNCTION_DEFINITION) {
+        if (journal) {
+            AnalyzerChange change = { AnalyzerChange::INLINE_DEFINITION, f.functionName, f.literalFunctions };
+            change.depth = depth;
+            journal->push_back(change);
+        }
+        DefinitionInfo& definition = definitions[f.functionName];
+        if (definition.count > 1 || definition.isInlineable) {
+            //a redefinition never runs, so it had better not be inlined either
+            ONLYDEBUG printf("%s was already defined, not adding it to the inlineDefinitions\n", f.functionName.c_str());
+            return;
+        }
+        if (memos.find(f.functionName) != memos.end()) {
+            //an inlined call would skip the cache
+            return;
+        }
         ONLYDEBUG printf("Adding %s to the inlineDefinitions\n", f.functionName.c_str());
-        inlineDefinitions[f.functionName] = f;
+        if (!definition.hasBody) {
+            definition.body = f.literalFunctions;
+            definition.size = codeSize(definition.body);
+            definition.hasBody = true;
+        }
+        definition.isInlineable = true;
+        definition.inlineDepth = depth;
+        generation++;
     } else {
         throw std::runtime_error("Tried to insert non-function definition into inlineDefinitions");
     }
 }
 
-bool FunctionAnalyzer::doInline(CHARM_LIST_TYPE& out, CharmFunction currentFunction) {
+void FunctionAnalyzer::countDefinition(const std::string& name) {
+    if (journal) {
+        journal->push_back({ AnalyzerChange::COUNT_DEFINITION, name });
+    }
+    definitions[name].count++;
+    generation++;
+}
+
+const CHARM_LIST_TYPE* FunctionAnalyzer::inlineBody(const std::string& name) const {
+    auto definition = definitions.find(name);
+    if (definition == definitions.end() || !definition->second.isInlineable) {
+        return nullptr;
+    }
+    return &definition->second.body;
+}
+
+unsigned int FunctionAnalyzer::definitionCount(const std::string& name) const {
+    auto definition = definitions.find(name);
+    return definition == definitions.end() ? 0 : definition->second.count;
+}
+
+bool FunctionAnalyzer::doInline(CHARM_LIST_TYPE& out, const CharmFunction& currentFunction) {
     //search through the inline definitions that have been parsed to see if this function is inlineable
-    auto fIter = inlineDefinitions.find(currentFunction.functionName);
-    ONLYDEBUG printf("Looking for inlineDefinition of %s, did we find it? %s\n", currentFunction.functionName.c_str(), fIter != inlineDefinitions.end() ? "Yes" : "No");
-    if (fIter != inlineDefinitions.end()) {
+    const CHARM_LIST_TYPE* body = inlineBody(currentFunction.functionName);
+    ONLYDEBUG printf("Looking for inlineDefinition of %s, did we find it? %s\n", currentFunction.functionName.c_str(), body != nullptr ? "Yes" : "No");
+    if (body != nullptr) {
         ONLYDEBUG printf("PERFORMING INLINE REPLACEMENT FOR %s\n    %s -> ", currentFunction.functionName.c_str(), currentFunction.functionName.c_str());
-        for (CharmFunction inlineReplacement : fIter->second.literalFunctions) {
+        for (const CharmFunction& inlineReplacement : *body) {
             out.push_back(inlineReplacement);
             ONLYDEBUG printf("%s ", charmFunctionToString(inlineReplacement).c_str());
         }
@@ -66,7 +268,207 @@ bool FunctionAnalyzer::doInline(CHARM_LIST_TYPE& out, CharmFunction currentFunct
     return false;
 }
 
-bool FunctionAnalyzer::_isInlineable(std::string fName, CharmFunction f, bool ignoreTypeSignature) {
+//the inliner's cost model. a call costs about as much as running a handful of instructions, so
+//bodies around that size are always worth inlining. anything bigger just bloats the code, and
+//every list literal in it gets copied each time it's pushed. quotations are usually the bodies
+//of loops, so they get a bigger budget
+static const unsigned long INLINE_BUDGET = 16;
+static const unsigned long QUOTATION_INLINE_BUDGET = 32;
+//how many levels of inlined calls can be nested inside each other
+static const unsigned int MAX_INLINE_DEPTH = 4;
+
+//whether `name` is called anywhere in the code, lists included
+static bool isCalledIn(const CHARM_LIST_TYPE& code, const std::string& name) {
+    for (const CharmFunction& f : code) {
+        if (f.functionType == DEFINED_FUNCTION && f.functionName == name) {
+            return true;
+        }
+        if (f.functionType == LIST_FUNCTION && isCalledIn(f.literalFunctions, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FunctionAnalyzer::inlineCall(CHARM_LIST_TYPE& out, const CharmFunction& f, InlineSite& site, bool inQuotation) {
+    auto found = definitions.find(f.functionName);
+    if (found == definitions.end() || !found->second.isInlineable || typeSignatures.find(f.functionName) != typeSignatures.end()) {
+        //recursive, not a definition at all, or it has a type signature (inferTypes deals with those)
+        return false;
+    }
+    DefinitionInfo& definition = found->second;
+    unsigned int depth = definition.inlineDepth + 1;
+    unsigned long budget = inQuotation ? QUOTATION_INLINE_BUDGET : INLINE_BUDGET;
+    bool willInline = false;
+    InlineDecision decision;
+    if (depth > MAX_INLINE_DEPTH) {
+        decision = TOO_DEEP_DECISION;
+    } else if (definition.size > budget) {
+        decision = inQuotation ? TOO_BIG_FOR_QUOTATION_DECISION : TOO_BIG_DECISION;
+    } else if (site.caller != "" && isCalledIn(definition.body, site.caller)) {
+        //it calls back into the definition it's being inlined into. once it's inlined, ifthen
+        //can see that as a tail call and loop instead of recursing. it's still held to the
+        //same limits as any other call, so a big mutually recursive pair isn't copied around
+        willInline = true;
+        decision = CALLS_CALLER_DECISION;
+    } else {
+        willInline = true;
+        decision = inQuotation ? INLINED_INTO_QUOTATION_DECISION : INLINED_DECISION;
+    }
+    definition.inlineDecisions[decision]++;
+    ONLYDEBUG printf("INLINER: %s %s\n", f.functionName.c_str(), willInline ? "inlined" : "not inlined");
+    if (!willInline) {
+        return false;
+    }
+    site.depth = std::max(site.depth, depth);
+    return FunctionAnalyzer::doInline(out, f);
+}
+
+void FunctionAnalyzer::inlineQuotations(CHARM_LIST_TYPE& code, const std::string& caller, unsigned int depth) {
+    //list literals aren't inlined into while parsing, since there's no telling yet if they're
+    //code or data. now there is, so inline into the ones that are only ever run.
+    //`depth` is how many of the quotations around this code were inlined into already. the
+    //quotations in inlined code get inlined into too, so without it two functions that call
+    //each other from their quotations would be inlined into each other forever
+    if (depth >= MAX_INLINE_DEPTH) {
+        return;
+    }
+    for (unsigned long n = 0; n < code.size(); n++) {
+        if (code[n].functionType != LIST_FUNCTION || !isQuotation(code, n)) {
+            continue;
+        }
+        CHARM_LIST_TYPE out;
+        InlineSite site = { caller, 0 };
+        bool inlined = false;
+        for (CharmFunction& f : code[n].literalFunctions) {
+            if (f.functionType == DEFINED_FUNCTION && FunctionAnalyzer::inlineCall(out, f, site, true)) {
+                optimizationCounts["inline: calls inlined into quotations"]++;
+                inlined = true;
+            } else {
+                out.push_back(std::move(f));
+            }
+        }
+        code[n].literalFunctions = std::move(out);
+        FunctionAnalyzer::inlineQuotations(code[n].literalFunctions, caller, inlined ? depth + 1 : depth);
+    }
+}
+
+//what every builtin (and superinstruction) does, see FunctionAnalyzer::Effect. anything
+//that's not in here and isn't a definition the analyzer knows about is UNKNOWN_EFFECT.
+//`i` and `ifthen` run lists, so they're handled by codeEffects
+static const std::unordered_map<std::string, unsigned int> SIDE_EFFECTS = {
+    { "p", FunctionAnalyzer::IO_EFFECT },
+    { "pstring", FunctionAnalyzer::IO_EFFECT },
+    { "newline", FunctionAnalyzer::IO_EFFECT },
+    { "getline", FunctionAnalyzer::IO_EFFECT },
+    { "memostats", FunctionAnalyzer::IO_EFFECT },
+    //what it pushes depends on everything that ran before it, so it's as good as input
+    { "stats", FunctionAnalyzer::IO_EFFECT },
+    //a different time every call, so as good as input too
+    { "clock", FunctionAnalyzer::IO_EFFECT },
+    //runs a list from the stack like `i` does
+    { "bench", FunctionAnalyzer::IO_EFFECT | FunctionAnalyzer::UNKNOWN_EFFECT },
+    { "type", 0 },
+    { "def", FunctionAnalyzer::DEFINES_EFFECT },
+    { "include", FunctionAnalyzer::DEFINES_EFFECT },
+    { "ffi", FunctionAnalyzer::FFI_EFFECT },
+    { "eq", 0 },
+    { "dup", 0 },
+    { "pop", 0 },
+    { "swap", 0 },
+    { "len", 0 },
+    { "at", 0 },
+    { "insert", 0 },
+    { "concat", 0 },
+    { "split", 0 },
+    { "tostring", 0 },
+    { "char", 0 },
+    { "ord", 0 },
+    { "q", 0 },
+    { "inline", 0 },
+    { "nor", 0 },
+    { "abs", 0 },
+    { "+", 0 },
+    { "-", 0 },
+    { "/", 0 },
+    { "*", 0 },
+    { "toint", 0 },
+    { "createstack", FunctionAnalyzer::STACKS_EFFECT },
+    { "getstack", FunctionAnalyzer::STACKS_EFFECT },
+    { "switchstack", FunctionAnalyzer::STACKS_EFFECT },
+    { "getref", FunctionAnalyzer::READS_REFS_EFFECT },
+    { "setref", FunctionAnalyzer::WRITES_REFS_EFFECT },
+    { "%flip", 0 },
+    { "%succ", 0 },
+    { "%not", 0 },
+    { "%permute", 0 },
+    { "%getref", FunctionAnalyzer::READS_REFS_EFFECT },
+    { "%setref", FunctionAnalyzer::WRITES_REFS_EFFECT },
+    { "%copyfrom", 0 },
+    { "%dupcopyfrom+", 0 },
+    { "%ifthen", 0 }
+};
+
+void FunctionAnalyzer::printAnalysis(const std::string& name, std::ostream& out) {
+    out << "analysis of `" << name << "`:" << std::endl;
+    if (SIDE_EFFECTS.count(name)) {
+        out << "    a builtin" << std::endl;
+        out << "    effects: " << effectsToString(getEffects(name)) << std::endl;
+        return;
+    }
+    auto found = definitions.find(name);
+    if (found == definitions.end() || found->second.count == 0) {
+        out << "    never defined (it might be a builtin)" << std::endl;
+        return;
+    }
+    const DefinitionInfo& definition = found->second;
+    out << "    defined " << definition.count << (definition.count == 1 ? " time" : " times") << std::endl;
+    out << "    effects: " << effectsToString(getEffects(name)) << std::endl;
+    auto typeSignature = typeSignatures.find(name);
+    if (typeSignature != typeSignatures.end()) {
+        out << "    type signature: " << charmTypeSignatureToString(typeSignature->second.signature) << std::endl;
+    }
+    auto memo = memos.find(name);
+    if (memo != memos.end()) {
+        out << "    memoized, caching up to " << memo->second.capacity << (memo->second.capacity == 1 ? " call" : " calls") << std::endl;
+    }
+    if (!definition.isInlineable) {
+        out << "    never inlined, it's recursive" << std::endl;
+    } else {
+        out << "    size " << definition.size << ", with " << definition.inlineDepth << " levels of inlining inside of it" << std::endl;
+        if (typeSignature != typeSignatures.end()) {
+            out << "    only inlined by the type inference, where its type signature is proven" << std::endl;
+        }
+    }
+    std::string tooBig = "not inlined, too big (size " + std::to_string(definition.size) + ", budget ";
+    const std::string decisionNames[INLINE_DECISION_COUNT] = {
+        "inlined",
+        "inlined into a quotation",
+        "inlined, it calls back into its caller",
+        "not inlined, too many levels of inlining",
+        tooBig + std::to_string(INLINE_BUDGET) + ")",
+        tooBig + std::to_string(QUOTATION_INLINE_BUDGET) + ")",
+        "inlined by the type inference",
+        "not inlined by the type inference, too big"
+    };
+    //sorted by name, like they've always been printed
+    std::map<std::string, unsigned long long> decisions;
+    for (unsigned int decision = 0; decision < INLINE_DECISION_COUNT; decision++) {
+        if (definition.inlineDecisions[decision] != 0) {
+            decisions[decisionNames[decision]] = definition.inlineDecisions[decision];
+        }
+    }
+    if (decisions.empty()) {
+        out << "    no calls to it were looked at by the inliner" << std::endl;
+        return;
+    }
+    out << "    inlining decisions:" << std::endl;
+    for (auto& decision : decisions) {
+        out << "        " << decision.first << ": " << decision.second << (decision.second == 1 ? " call" : " calls") << std::endl;
+    }
+}
+
+bool FunctionAnalyzer::_isInlineable(const std::string& fName, const CharmFunction& f, bool ignoreTypeSignature) {
 	//if the function calls itself, it's recursive and not inlineable
 	bool recursive = false;
 	for (unsigned long long fIndex = 0; fIndex < f.literalFunctions.size(); fIndex++) {
@@ -89,14 +491,14 @@ bool FunctionAnalyzer::_isInlineable(std::string fName, CharmFunction f, bool ig
     ONLYDEBUG printf("_isInlineable USING TYPE SIGNATURE FOR FUNCTION %s: %s\n", fName.c_str(), (!recursive && !hasTypeSignature) ? "Inlineable" : "Non-inlineable");
 	return (!recursive && !hasTypeSignature);
 }
-bool FunctionAnalyzer::isInlinable(CharmFunction f) {
+bool FunctionAnalyzer::isInlinable(const CharmFunction& f) {
 	return (_isInlineable(f.functionName, f, false));
 }
-bool FunctionAnalyzer::isInlinableIgnoringTypeSignature(CharmFunction f) {
+bool FunctionAnalyzer::isInlinableIgnoringTypeSignature(const CharmFunction& f) {
 	return (_isInlineable(f.functionName, f, true));
 }
 
-bool FunctionAnalyzer::isTailCallRecursive(CharmFunction f) {
+bool FunctionAnalyzer::isTailCallRecursive(const CharmFunction& f) {
 	//this is only static, basic tail call recursion analysis.
 	//this only catches functions of form `f := <code> f`
 	//and sends this flag off to Runner.cpp::handleDefinedFunctions()
@@ -108,3 +510,1071 @@ bool FunctionAnalyzer::isTailCallRecursive(CharmFunction f) {
         return false;
     }
 }
+
+unsigned int FunctionAnalyzer::enabledPasses = PEEPHOLE_PASS | PERMUTE_PASS | FOLD_PASS | TYPECHECK_PASS | INLINE_PASS | BRANCH_PASS;
+bool FunctionAnalyzer::arePushesChecked = true;
+std::map<std::string, unsigned long long> FunctionAnalyzer::optimizationCounts;
+
+bool FunctionAnalyzer::setPassEnabled(const std::string& name, bool enabled) {
+    static const std::vector<std::pair<std::string, unsigned int>> passNames = {
+        { "typecheck", TYPECHECK_PASS },
+        { "fold", FOLD_PASS },
+        { "peephole", PEEPHOLE_PASS },
+        { "permute", PERMUTE_PASS },
+        { "inline", INLINE_PASS },
+        { "branch", BRANCH_PASS }
+    };
+    for (auto& pass : passNames) {
+        if (pass.first == name || name == "all") {
+            if (enabled) {
+                enabledPasses |= pass.second;
+            } else {
+                enabledPasses &= ~pass.second;
+            }
+            if (name != "all") {
+                return true;
+            }
+        }
+    }
+    return name == "all";
+}
+
+void FunctionAnalyzer::printOptimizationReport(std::ostream& out) {
+    out << "optimization report:" << std::endl;
+    if (optimizationCounts.empty()) {
+        out << "    nothing fired" << std::endl;
+    }
+    for (auto& count : optimizationCounts) {
+        out << "    " << count.first << ": " << count.second << std::endl;
+    }
+}
+
+void FunctionAnalyzer::optimize(CHARM_LIST_TYPE& code, const std::string& definitionName) {
+    //definition bodies were optimized when they were parsed, so a line that only
+    //defines functions has nothing left to do
+    if (std::all_of(code.begin(), code.end(), [](const CharmFunction& f) { return f.functionType == FUNCTION_DEFINITION; })) {
+        return;
+    }
+    //inlining into quotations goes first, so that every other pass gets to see the inlined code
+    if (OPTIMIZE_INLINE && (enabledPasses & INLINE_PASS)) {
+        FunctionAnalyzer::inlineQuotations(code, definitionName);
+    }
+    //`[ code ] i` is just `code`, and everything after this can follow it that way
+    if (enabledPasses & BRANCH_PASS) {
+        FunctionAnalyzer::spliceQuotations(code);
+    }
+    //then type inference, since it inlines functions with type signatures and
+    //everything after that gets to see their bodies
+    if (enabledPasses & TYPECHECK_PASS) {
+        FunctionAnalyzer::inferTypes(code);
+    }
+    //folding goes first, so that ex: `2 1 +` becomes 3 instead of `2 %succ`
+    if (enabledPasses & FOLD_PASS) {
+        FunctionAnalyzer::fold(code);
+    }
+    if (enabledPasses & PEEPHOLE_PASS) {
+        FunctionAnalyzer::peephole(code);
+    }
+    if (enabledPasses & PERMUTE_PASS) {
+        FunctionAnalyzer::permute(code);
+    }
+    //this goes last, since the other passes only look inside of lists they can see
+    if (enabledPasses & BRANCH_PASS) {
+        FunctionAnalyzer::compileBranches(code);
+    }
+}
+
+void FunctionAnalyzer::invalidateCompiledQuotations() {
+    generation++;
+}
+
+std::shared_ptr<const CHARM_LIST_TYPE> FunctionAnalyzer::compileQuotation(const CharmFunction& list) {
+    if (!list.compiled) {
+        return nullptr;
+    }
+    CompiledQuotation& compiled = *list.compiled;
+    if (!compiled.code || compiled.analyzer != this || compiled.generation != generation) {
+        //optimize a copy, the list itself is a value and has to stay the way it was written
+        CHARM_LIST_TYPE code = list.literalFunctions;
+        FunctionAnalyzer::optimize(code);
+        compiled.code = std::make_shared<const CHARM_LIST_TYPE>(std::move(code));
+        compiled.analyzer = this;
+        compiled.generation = generation;
+        optimizationCounts["quotation: lists compiled at runtime"]++;
+    }
+    return compiled.code;
+}
+
+void FunctionAnalyzer::spliceQuotations(CHARM_LIST_TYPE& code) {
+    //running a list literal with `i` runs exactly the code in the list, so that code can
+    //just go where the list was
+    CHARM_LIST_TYPE out;
+    for (unsigned long n = 0; n < code.size(); n++) {
+        if (code[n].functionType == LIST_FUNCTION && isQuotation(code, n)) {
+            FunctionAnalyzer::spliceQuotations(code[n].literalFunctions);
+            bool isRunByI = n + 1 < code.size() && code[n + 1].functionType == DEFINED_FUNCTION && code[n + 1].functionName == "i";
+            if (isRunByI) {
+                out.insert(out.end(), std::make_move_iterator(code[n].literalFunctions.begin()), std::make_move_iterator(code[n].literalFunctions.end()));
+                optimizationCounts["branch: [ code ] i spliced inline"]++;
+                //skip the i
+                n++;
+                continue;
+            }
+        }
+        out.push_back(std::move(code[n]));
+    }
+    code = std::move(out);
+}
+
+void FunctionAnalyzer::compileBranches(CHARM_LIST_TYPE& code) {
+    //`[ cond ] [ truthy ] [ falsy ] ifthen` becomes %ifthen, which runs the lists without
+    //ever putting them on the stack. ifthen is still there for lists that aren't literals
+    CHARM_LIST_TYPE out;
+    for (unsigned long n = 0; n < code.size(); n++) {
+        bool isLiteralIfthen = n + 3 < code.size() &&
+            code[n].functionType == LIST_FUNCTION &&
+            code[n + 1].functionType == LIST_FUNCTION &&
+            code[n + 2].functionType == LIST_FUNCTION &&
+            code[n + 3].functionType == DEFINED_FUNCTION && code[n + 3].functionName == "ifthen";
+        if (isLiteralIfthen) {
+            //same layout as the other superinstructions: the code it replaced, then the operands
+            CharmFunction original;
+            original.functionType = LIST_FUNCTION;
+            original.literalFunctions = CHARM_LIST_TYPE(code.begin() + n, code.begin() + n + 4);
+            CharmFunction fused;
+            fused.functionType = DEFINED_FUNCTION;
+            fused.functionName = "%ifthen";
+            fused.literalFunctions.push_back(std::move(original));
+            for (unsigned long list = n; list < n + 3; list++) {
+                fused.literalFunctions.push_back(std::move(code[list]));
+                FunctionAnalyzer::compileBranches(fused.literalFunctions.back().literalFunctions);
+            }
+            out.push_back(std::move(fused));
+            optimizationCounts["branch: ifthen compiled to %ifthen"]++;
+            //skip the lists and the ifthen
+            n += 3;
+            continue;
+        }
+        if (code[n].functionType == LIST_FUNCTION && isQuotation(code, n)) {
+            FunctionAnalyzer::compileBranches(code[n].literalFunctions);
+        }
+        out.push_back(std::move(code[n]));
+    }
+    code = std::move(out);
+}
+
+//the peephole rewrites, as (pattern, superinstruction). patterns are written the way code looks
+//after inlining. $int and $string match any int or string literal, and get handed to the
+//superinstruction as operands. the superinstructions are builtins, see the SUPERINSTRUCTIONS
+//section of PredefinedFunctions.cpp. longer patterns are tried first
+static const std::vector<std::pair<std::string, std::string>> PEEPHOLE_PATTERNS = {
+    { "0 1 swap", "%flip" },
+    { "flip", "%flip" },
+    { "1 +", "%succ" },
+    { "succ", "%succ" },
+    { "dup nor", "%not" },
+    { "not", "%not" },
+    { "$string getref", "%getref" },
+    { "$string flip setref", "%setref" },
+    { "$string 0 1 swap setref", "%setref" },
+    { "$int copyfrom", "%copyfrom" },
+    { "dup $int copyfrom +", "%dupcopyfrom+" }
+};
+//anything in a pattern that isn't a builtin has to be one of these prelude words. a word
+//only matches if it was defined exactly once, with this body (so redefining `flip` turns
+//off every pattern that uses it)
+static const std::vector<std::pair<std::string, std::string>> PEEPHOLE_WORDS = {
+    { "flip", "0 1 swap" },
+    { "succ", "1 +" },
+    { "not", "dup nor" },
+    { "copyfrom", "\" copyfromref \" flip setref 0 \" copyfromref \" getref swap dup 1 \" copyfromref \" getref 1 + swap" }
+};
+
+struct PeepholePattern {
+    std::string source;
+    std::string superinstruction;
+    CHARM_LIST_TYPE code;
+};
+struct PeepholeTables {
+    std::vector<PeepholePattern> patterns;
+    std::unordered_map<std::string, CHARM_LIST_TYPE> words;
+};
+
+static const PeepholeTables& peepholeTables() {
+    //lexed once, the first time anything is optimized
+    static const PeepholeTables tables = []() {
+        PeepholeTables out;
+        Parser patternParser = Parser();
+        for (auto& pattern : PEEPHOLE_PATTERNS) {
+            out.patterns.push_back({ pattern.first, pattern.second, patternParser.lexAskToInline(pattern.first, false).first });
+        }
+        std::stable_sort(out.patterns.begin(), out.patterns.end(), [](const PeepholePattern& a, const PeepholePattern& b) {
+            return a.code.size() > b.code.size();
+        });
+        for (auto& word : PEEPHOLE_WORDS) {
+            out.words[word.first] = patternParser.lexAskToInline(word.second, false).first;
+        }
+        return out;
+    }();
+    return tables;
+}
+
+bool FunctionAnalyzer::isWordTrusted(const std::string& name) {
+    auto expected = peepholeTables().words.find(name);
+    if (expected == peepholeTables().words.end()) {
+        //builtins always win over definitions, so they can't be messed with
+        return true;
+    }
+    const CHARM_LIST_TYPE* body = inlineBody(name);
+    if (definitionCount(name) != 1 || body == nullptr) {
+        return false;
+    }
+    if (!(*body == expected->second)) {
+        return false;
+    }
+    //the body can lean on other prelude words too (ex: copyfrom uses flip)
+    for (const CharmFunction& f : expected->second) {
+        if (f.functionType == DEFINED_FUNCTION && f.functionName != name && !isWordTrusted(f.functionName)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FunctionAnalyzer::matchPattern(const CHARM_LIST_TYPE& code, unsigned long start, const CHARM_LIST_TYPE& pattern, CHARM_LIST_TYPE& operands) {
+    if (start + pattern.size() > code.size()) {
+        return false;
+    }
+    for (unsigned long n = 0; n < pattern.size(); n++) {
+        const CharmFunction& p = pattern[n];
+        const CharmFunction& c = code[start + n];
+        if (p.functionType == DEFINED_FUNCTION && p.functionName == "$int") {
+            if (c.functionType != NUMBER_FUNCTION || c.numberValue.whichType != INTEGER_VALUE) {
+                return false;
+            }
+            operands.push_back(c);
+        } else if (p.functionType == DEFINED_FUNCTION && p.functionName == "$string") {
+            if (c.functionType != STRING_FUNCTION) {
+                return false;
+            }
+            operands.push_back(c);
+        } else if (p.functionType == DEFINED_FUNCTION) {
+            if (c.functionType != DEFINED_FUNCTION || c.functionName != p.functionName || !isWordTrusted(p.functionName)) {
+                return false;
+            }
+        } else if (!(p == c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//words that run some of the list literals right before them and never look inside of them, as
+//(word, how many lists it runs, type signature). builtins have no type signature, since they
+//can't be redefined. prelude words only count if they were defined exactly once, and still
+//have the type signature the prelude gives them
+struct QuotationWord {
+    std::string name;
+    unsigned int lists;
+    std::string typeSignature;
+};
+static const std::vector<QuotationWord> QUOTATION_WORDS = {
+    { "i", 1, "" },
+    { "ifthen", 3, "" },
+    { "map", 1, "list list -> list " },
+    { "for", 1, "list list -> " },
+    { "revfor", 1, "list list -> " },
+    { "while", 2, "list list -> " }
+};
+
+//whether the list literal at code[n] can only ever be run and never looked at, so it's safe
+//to optimize. ex: the three lists right before an `ifthen`, or the list right before an `i`
+bool FunctionAnalyzer::isQuotation(const CHARM_LIST_TYPE& code, unsigned long n) {
+    for (unsigned long end = n + 1; end <= n + 3 && end < code.size(); end++) {
+        if (code[end].functionType == LIST_FUNCTION) {
+            continue;
+        }
+        if (code[end].functionType != DEFINED_FUNCTION) {
+            return false;
+        }
+        for (const QuotationWord& word : QUOTATION_WORDS) {
+            if (code[end].functionName != word.name || end - n > word.lists || end < word.lists) {
+                continue;
+            }
+            //every list it runs has to be a literal
+            for (unsigned long list = end - word.lists; list < end; list++) {
+                if (code[list].functionType != LIST_FUNCTION) {
+                    return false;
+                }
+            }
+            if (word.typeSignature == "") {
+                return true;
+            }
+            auto typeSignature = typeSignatures.find(word.name);
+            return definitionCount(word.name) == 1 && typeSignature != typeSignatures.end() &&
+                charmTypeSignatureToString(typeSignature->second.signature) == word.typeSignature;
+        }
+        return false;
+    }
+    return false;
+}
+
+void FunctionAnalyzer::addDefinitionBody(const std::string& name, const CHARM_LIST_TYPE& body) {
+    if (journal) {
+        journal->push_back({ AnalyzerChange::DEFINITION_BODY, name, body });
+    }
+    //like the definitions themselves, the first one wins
+    DefinitionInfo& definition = definitions[name];
+    if (!definition.hasBody) {
+        definition.body = body;
+        definition.size = codeSize(body);
+        definition.hasBody = true;
+        generation++;
+    }
+}
+
+unsigned int FunctionAnalyzer::codeEffects(const CHARM_LIST_TYPE& code) {
+    unsigned int out = 0;
+    for (unsigned long n = 0; n < code.size(); n++) {
+        const CharmFunction& f = code[n];
+        if (f.functionType != DEFINED_FUNCTION) {
+            //a list literal might get run, so it counts as if it was. superinstructions
+            //keep their operands (and the code they replaced) in here too
+            out |= FunctionAnalyzer::codeEffects(f.literalFunctions);
+            continue;
+        }
+        out |= FunctionAnalyzer::codeEffects(f.literalFunctions);
+        if (f.functionName == "i" || f.functionName == "ifthen") {
+            //the lists it runs were counted above, as long as they're literals
+            unsigned long lists = f.functionName == "i" ? 1 : 3;
+            bool literal = n >= lists;
+            for (unsigned long list = n - std::min(n, lists); literal && list < n; list++) {
+                literal = code[list].functionType == LIST_FUNCTION;
+            }
+            if (!literal) {
+                out |= UNKNOWN_EFFECT;
+            }
+            continue;
+        }
+        auto builtin = SIDE_EFFECTS.find(f.functionName);
+        if (builtin != SIDE_EFFECTS.end()) {
+            out |= builtin->second;
+            continue;
+        }
+        auto definition = definitions.find(f.functionName);
+        if (definition == definitions.end() || !definition->second.hasBody) {
+            out |= UNKNOWN_EFFECT;
+        } else if (n > 0 && code[n - 1].functionType == LIST_FUNCTION && isQuotation(code, n - 1)) {
+            //ex: `[ ... ] map`. the only unknown code map runs is the list right before it
+            out |= definition->second.effects & ~UNKNOWN_EFFECT;
+        } else {
+            out |= definition->second.effects;
+        }
+    }
+    return out;
+}
+
+//every definition the code calls, lists and superinstruction operands included
+static void collectCalls(const CHARM_LIST_TYPE& code, std::vector<std::string>& out) {
+    for (const CharmFunction& f : code) {
+        if (f.functionType == DEFINED_FUNCTION) {
+            out.push_back(f.functionName);
+        }
+        collectCalls(f.literalFunctions, out);
+    }
+}
+
+void FunctionAnalyzer::analyzeEffects(const std::string& name) {
+    //only the definitions `name` can reach are looked at, so asking about one function costs
+    //as much as the code it calls, no matter how big the rest of the program is
+    std::vector<DefinitionInfo*> reachable;
+    std::unordered_map<std::string, bool> seen;
+    std::vector<std::string> toVisit = { name };
+    while (!toVisit.empty()) {
+        std::string next = toVisit.back();
+        toVisit.pop_back();
+        auto definition = definitions.find(next);
+        if (definition == definitions.end() || !definition->second.hasBody || !seen.emplace(next, true).second) {
+            continue;
+        }
+        reachable.push_back(&definition->second);
+        collectCalls(definition->second.body, toVisit);
+    }
+    //start with every one of them doing nothing, and keep adding what the functions it calls
+    //do until nothing changes. that's how recursive functions end up with the right answer
+    for (DefinitionInfo* definition : reachable) {
+        definition->effects = 0;
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (DefinitionInfo* definition : reachable) {
+            unsigned int found = FunctionAnalyzer::codeEffects(definition->body);
+            if ((found | definition->effects) != definition->effects) {
+                definition->effects |= found;
+                changed = true;
+            }
+        }
+    }
+}
+
+unsigned int FunctionAnalyzer::getEffects(const std::string& name) {
+    auto builtin = SIDE_EFFECTS.find(name);
+    if (builtin != SIDE_EFFECTS.end()) {
+        return builtin->second;
+    }
+    auto definition = definitions.find(name);
+    if (definition == definitions.end() || !definition->second.hasBody) {
+        return UNKNOWN_EFFECT;
+    }
+    FunctionAnalyzer::analyzeEffects(name);
+    return definition->second.effects;
+}
+
+std::string FunctionAnalyzer::effectsToString(unsigned int e) {
+    static const std::vector<std::pair<Effect, std::string>> names = {
+        { READS_REFS_EFFECT, "reads refs" },
+        { WRITES_REFS_EFFECT, "writes refs" },
+        { STACKS_EFFECT, "switches or creates stacks" },
+        { IO_EFFECT, "does I/O" },
+        { FFI_EFFECT, "calls ffi" },
+        { DEFINES_EFFECT, "defines functions" },
+        { UNKNOWN_EFFECT, "runs code it can't see" }
+    };
+    if (e == 0) {
+        return "stack only";
+    }
+    std::string out;
+    for (auto& name : names) {
+        if (e & name.first) {
+            out += (out == "" ? "" : ", ") + name.second;
+        }
+    }
+    return out;
+}
+
+void FunctionAnalyzer::peephole(CHARM_LIST_TYPE& code) {
+    CHARM_LIST_TYPE out;
+    unsigned long n = 0;
+    while (n < code.size()) {
+        if (code[n].functionType == LIST_FUNCTION && isQuotation(code, n)) {
+            FunctionAnalyzer::peephole(code[n].literalFunctions);
+        }
+        bool matched = false;
+        for (const PeepholePattern& pattern : peepholeTables().patterns) {
+            CHARM_LIST_TYPE operands;
+            if (FunctionAnalyzer::matchPattern(code, n, pattern.code, operands)) {
+                //the superinstruction keeps the code it replaced as its first operand, so it can
+                //fall back on running that whenever it can't take the fast path
+                CharmFunction original;
+                original.functionType = LIST_FUNCTION;
+                original.literalFunctions = CHARM_LIST_TYPE(std::make_move_iterator(code.begin() + n), std::make_move_iterator(code.begin() + n + pattern.code.size()));
+                CharmFunction fused;
+                fused.functionType = DEFINED_FUNCTION;
+                fused.functionName = pattern.superinstruction;
+                fused.literalFunctions.push_back(std::move(original));
+                fused.literalFunctions.insert(fused.literalFunctions.end(), std::make_move_iterator(operands.begin()), std::make_move_iterator(operands.end()));
+                ONLYDEBUG printf("PEEPHOLE: %s -> %s\n", pattern.source.c_str(), pattern.superinstruction.c_str());
+                out.push_back(std::move(fused));
+                optimizationCounts["peephole: " + pattern.source + " -> " + pattern.superinstruction]++;
+                n += pattern.code.size();
+                matched = true;
+                break;
+            }
+        }
+        if (!matched) {
+            out.push_back(std::move(code[n]));
+            n++;
+        }
+    }
+    code = std::move(out);
+}
+
+//a run of stack shuffling with constant indices (swap, dup, pop and flip) always does the same
+//thing: it takes the top k values off of the stack and pushes back some arrangement of them.
+//the stack is treated as having infinite zeros below it, just like Stack::pop and Stack::swap do.
+//runs that reach deeper than this are left alone, since permute would have to move every value
+static const unsigned long PERMUTE_MAX_DEPTH = 8;
+
+struct StackShuffle {
+    //what's on the stack, as indices into the values that were taken (0 is the top one).
+    //the back is the top of the stack. never more than a few values, so a vector is
+    //cheaper than a deque even with the inserts at the front
+    std::vector<unsigned long> values;
+    //how many values have been taken off of the real stack
+    unsigned long taken = 0;
+
+    //make sure `depth` (0 is the top) is known
+    void reach(unsigned long depth) {
+        while (values.size() <= depth) {
+            values.insert(values.begin(), taken++);
+        }
+    }
+    void swap(unsigned long n1, unsigned long n2) {
+        reach(std::max(n1, n2));
+        std::swap(values[values.size() - 1 - n1], values[values.size() - 1 - n2]);
+    }
+    bool isIdentity() {
+        for (unsigned long n = 0; n < values.size(); n++) {
+            if (values[n] != values.size() - 1 - n) {
+                return false;
+            }
+        }
+        return values.size() == taken;
+    }
+};
+
+unsigned long FunctionAnalyzer::shuffleStep(const CHARM_LIST_TYPE& code, unsigned long n, StackShuffle& shuffle) {
+    //returns how many functions the step took up, or 0 if code[n] doesn't start one
+    auto isCall = [&](unsigned long index, const char* name) {
+        return index < code.size() && code[index].functionType == DEFINED_FUNCTION && code[index].functionName == name;
+    };
+    auto isIndex = [&](unsigned long index) {
+        return index < code.size() && code[index].functionType == NUMBER_FUNCTION &&
+            code[index].numberValue.whichType == INTEGER_VALUE &&
+            code[index].numberValue.integerValue >= 0 && code[index].numberValue.integerValue < PERMUTE_MAX_DEPTH;
+    };
+    if (isCall(n, "dup")) {
+        shuffle.reach(0);
+        shuffle.values.push_back(shuffle.values.back());
+        return 1;
+    } else if (isCall(n, "pop")) {
+        shuffle.reach(0);
+        shuffle.values.pop_back();
+        return 1;
+    } else if (isCall(n, "%flip") || (isCall(n, "flip") && isWordTrusted("flip"))) {
+        shuffle.swap(1, 0);
+        return 1;
+    } else if (isIndex(n) && isIndex(n + 1) && isCall(n + 2, "swap")) {
+        shuffle.swap(code[n].numberValue.integerValue.get_ui(), code[n + 1].numberValue.integerValue.get_ui());
+        return 3;
+    }
+    return 0;
+}
+
+void FunctionAnalyzer::permute(CHARM_LIST_TYPE& code) {
+    CHARM_LIST_TYPE out;
+    unsigned long n = 0;
+    while (n < code.size()) {
+        if (code[n].functionType == LIST_FUNCTION && isQuotation(code, n)) {
+            FunctionAnalyzer::permute(code[n].literalFunctions);
+        }
+        //find the longest run starting here
+        StackShuffle shuffle;
+        unsigned long end = n;
+        while (true) {
+            StackShuffle next = shuffle;
+            unsigned long length = FunctionAnalyzer::shuffleStep(code, end, next);
+            if (length == 0 || next.taken > PERMUTE_MAX_DEPTH) {
+                break;
+            }
+            shuffle = next;
+            end += length;
+        }
+        if (end == n) {
+            out.push_back(std::move(code[n]));
+            n++;
+            continue;
+        }
+        if (shuffle.isIdentity()) {
+            //ex: flip flip, dup pop. nothing to do at all
+            optimizationCounts["permute: removed runs that did nothing"]++;
+        } else if (end - n > 1) {
+            CharmFunction original;
+            original.functionType = LIST_FUNCTION;
+            original.literalFunctions = CHARM_LIST_TYPE(std::make_move_iterator(code.begin() + n), std::make_move_iterator(code.begin() + end));
+            CharmFunction taken;
+            taken.functionType = NUMBER_FUNCTION;
+            taken.numberValue.whichType = INTEGER_VALUE;
+            taken.numberValue.integerValue = shuffle.taken;
+            CharmFunction pushed;
+            pushed.functionType = LIST_FUNCTION;
+            for (unsigned long value : shuffle.values) {
+                CharmFunction index = taken;
+                index.numberValue.integerValue = value;
+                pushed.literalFunctions.push_back(index);
+            }
+            CharmFunction fused;
+            fused.functionType = DEFINED_FUNCTION;
+            fused.functionName = "%permute";
+            fused.literalFunctions.push_back(std::move(original));
+            fused.literalFunctions.push_back(std::move(taken));
+            fused.literalFunctions.push_back(std::move(pushed));
+            ONLYDEBUG printf("PERMUTE: %lu functions -> %%permute\n", end - n);
+            out.push_back(std::move(fused));
+            optimizationCounts["permute: collapsed runs into %permute"]++;
+        } else {
+            //a lone dup, pop or flip is already as short as it gets
+            out.insert(out.end(), std::make_move_iterator(code.begin() + n), std::make_move_iterator(code.begin() + end));
+        }
+        n = end;
+    }
+    code = std::move(out);
+}
+
+//builtins that only depend on what they pop, along with how many values they pop. when all of
+//those are literals, the builtin can be run ahead of time and replaced with what it pushed
+static const std::unordered_map<std::string, unsigned long> FOLDABLE_BUILTINS = {
+    { "+", 2 }, { "-", 2 }, { "*", 2 }, { "/", 2 }, { "nor", 2 }, { "concat", 2 },
+    { "char", 1 }, { "ord", 1 }, { "len", 1 }, { "tostring", 1 }
+};
+
+static bool isLiteral(const CharmFunction& f) {
+    return f.functionType == NUMBER_FUNCTION || f.functionType == STRING_FUNCTION || f.functionType == LIST_FUNCTION;
+}
+
+//run a builtin on some literals with a runner of its own, so it does exactly what it would
+//have done at runtime. returns what it left on the stack, or nothing if it errored
+static std::optional<CHARM_LIST_TYPE> runAheadOfTime(FunctionAnalyzer* fA, const std::string& name, CHARM_LIST_TYPE::const_iterator begin, CHARM_LIST_TYPE::const_iterator end) {
+    static Runner foldingRunner = Runner();
+    std::optional<CHARM_LIST_TYPE> out;
+    Stack* s = foldingRunner.getCurrentStack();
+    s->stack.clear();
+    for (auto f = begin; f != end; f++) {
+        s->push(*f);
+    }
+    RunnerContext context = Runner::topLevelContext(fA);
+    bool wereErrorsQuiet = setQuietErrors(true);
+    try {
+        foldingRunner.pF->functionLookup(name, &foldingRunner, context);
+        out = CHARM_LIST_TYPE(s->stack.begin(), s->stack.end());
+    } catch (std::runtime_error& e) {
+        //leave it for runtime, which reports the error properly
+    }
+    setQuietErrors(wereErrorsQuiet);
+    return out;
+}
+
+void FunctionAnalyzer::fold(CHARM_LIST_TYPE& code) {
+    CHARM_LIST_TYPE out;
+    for (unsigned long n = 0; n < code.size(); n++) {
+        if (code[n].functionType == LIST_FUNCTION && isQuotation(code, n)) {
+            FunctionAnalyzer::fold(code[n].literalFunctions);
+        }
+        if (code[n].functionType == DEFINED_FUNCTION) {
+            auto builtin = FOLDABLE_BUILTINS.find(code[n].functionName);
+            //everything it pops has to be a literal pushed right before it. if even one
+            //isn't, what it pops depends on the stack at runtime
+            if (builtin != FOLDABLE_BUILTINS.end() && out.size() >= builtin->second &&
+                std::all_of(out.end() - builtin->second, out.end(), isLiteral)) {
+                std::optional<CHARM_LIST_TYPE> result = runAheadOfTime(this, builtin->first, out.end() - builtin->second, out.end());
+                if (result) {
+                    ONLYDEBUG printf("FOLDED %s\n", builtin->first.c_str());
+                    out.erase(out.end() - builtin->second, out.end());
+                    out.insert(out.end(), std::make_move_iterator(result->begin()), std::make_move_iterator(result->end()));
+                    optimizationCounts["fold: " + builtin->first]++;
+                    continue;
+                }
+            }
+        }
+        out.push_back(std::move(code[n]));
+    }
+    code = std::move(out);
+}
+
+//what the type inference knows about one value on the top of the stack
+struct TypeSlot {
+    unsigned int types;
+    //the value, if it's an int literal small enough to be handed to swap. otherwise -1
+    long index;
+};
+
+//what the builtins do to the stack if they return normally: how many values they pop, and
+//the types of what they push. a negative push is the type of a popped value (-1 is the top)
+struct BuiltinEffect {
+    unsigned int pops;
+    std::vector<int> pushes;
+};
+static const int SAME_AS_TOP = -1;
+static const int SAME_AS_SECOND = -2;
+static const int SAME_AS_THIRD = -3;
+static const std::unordered_map<std::string, BuiltinEffect> BUILTIN_EFFECTS = {
+    { "p", { 1, {} } },
+    { "pstring", { 1, {} } },
+    { "newline", { 0, {} } },
+    { "getline", { 0, { STRING_TYPE } } },
+    { "stats", { 0, { LIST_TYPE } } },
+    { "clock", { 0, { INT_TYPE } } },
+    //whatever the list does to the stack is undone
+    { "bench", { 2, { LIST_TYPE } } },
+    { "type", { 1, { SAME_AS_TOP, STRING_TYPE } } },
+    { "eq", { 2, { INT_TYPE } } },
+    { "dup", { 1, { SAME_AS_TOP, SAME_AS_TOP } } },
+    { "pop", { 1, {} } },
+    { "len", { 1, { SAME_AS_TOP, INT_TYPE } } },
+    { "at", { 2, { SAME_AS_SECOND, LIST_TYPE | STRING_TYPE } } },
+    { "insert", { 3, { SAME_AS_THIRD } } },
+    { "concat", { 2, { SAME_AS_SECOND } } },
+    { "split", { 2, { LIST_TYPE | STRING_TYPE, LIST_TYPE | STRING_TYPE } } },
+    { "tostring", { 1, { STRING_TYPE } } },
+    { "char", { 1, { STRING_TYPE } } },
+    { "ord", { 1, { INT_TYPE } } },
+    { "q", { 1, { LIST_TYPE } } },
+    { "nor", { 2, { INT_TYPE } } },
+    { "abs", { 1, { SAME_AS_TOP } } },
+    { "+", { 2, { INT_TYPE } } },
+    { "-", { 2, { INT_TYPE } } },
+    { "*", { 2, { INT_TYPE } } },
+    { "/", { 2, { INT_TYPE, INT_TYPE } } },
+    { "toint", { 1, {} } },
+    { "createstack", { 1, {} } },
+    { "getstack", { 0, { ANY_TYPE } } },
+    { "getref", { 1, { ANY_TYPE } } },
+    { "setref", { 2, {} } }
+};
+//anything deeper than this is forgotten about after a swap
+static const long MAX_INFERRED_DEPTH = 64;
+//how deep inlining functions with type signatures can go, in case they call each other
+static const unsigned int MAX_TYPED_INLINE_DEPTH = 8;
+
+//what a literal or a call to something without a type signature does to what's known about the
+//stack. anything it can't follow makes it forget everything
+static void inferEffect(const CharmFunction& f, std::vector<TypeSlot>& stack) {
+    auto popSlot = [&]() {
+        TypeSlot slot = { ANY_TYPE, -1 };
+        if (!stack.empty()) {
+            slot = stack.back();
+            stack.pop_back();
+        }
+        return slot;
+    };
+    if (f.functionType == NUMBER_FUNCTION) {
+        bool isInt = f.numberValue.whichType == INTEGER_VALUE;
+        long index = -1;
+        if (isInt && f.numberValue.integerValue >= 0 && f.numberValue.integerValue < MAX_INFERRED_DEPTH) {
+            index = f.numberValue.integerValue.get_si();
+        }
+        stack.push_back({ isInt ? INT_TYPE : FLOAT_TYPE, index });
+    } else if (f.functionType == STRING_FUNCTION) {
+        stack.push_back({ STRING_TYPE, -1 });
+    } else if (f.functionType == LIST_FUNCTION) {
+        stack.push_back({ LIST_TYPE, -1 });
+    } else if (f.functionType == DEFINED_FUNCTION) {
+        auto effect = BUILTIN_EFFECTS.find(f.functionName);
+        if (f.functionName == "swap") {
+            TypeSlot n1 = popSlot();
+            TypeSlot n2 = popSlot();
+            if (n1.index >= 0 && n2.index >= 0) {
+                while (stack.size() <= (unsigned long)std::max(n1.index, n2.index)) {
+                    stack.insert(stack.begin(), { ANY_TYPE, -1 });
+                }
+                std::swap(stack[stack.size() - 1 - n1.index], stack[stack.size() - 1 - n2.index]);
+            } else {
+                stack.clear();
+            }
+        } else if (effect != BUILTIN_EFFECTS.end()) {
+            std::vector<TypeSlot> popped;
+            for (unsigned int n = 0; n < effect->second.pops; n++) {
+                popped.push_back(popSlot());
+            }
+            for (int push : effect->second.pushes) {
+                if (push < 0) {
+                    stack.push_back(popped[-push - 1]);
+                } else {
+                    stack.push_back({ (unsigned int)push, -1 });
+                }
+            }
+        } else {
+            stack.clear();
+        }
+    } else {
+        //definitions don't touch the stack
+    }
+}
+
+//this has to line up with Runner::typeSignatureTick: it looks at the top maxLength values,
+//and checks the first pops.size() of them (deepest first) against the unit's pops
+static bool arePopsProven(const CompiledTypeSignature& t, const CompiledTypeSignatureUnit& unit, const std::vector<TypeSlot>& stack) {
+    for (unsigned int n = 0; n < unit.pops.size(); n++) {
+        unsigned long depth = t.maxLength - 1 - n;
+        //past what we know about, it could be anything (including a padding zero)
+        unsigned int types = depth < stack.size() ? stack[stack.size() - 1 - depth].types : ANY_TYPE;
+        if (types & ~unit.pops[n]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FunctionAnalyzer::arePushesProven(const CompiledTypeSignature& t, std::vector<TypeSlot> stack, const CHARM_LIST_TYPE& body) {
+    //only the units whose pops are proven are sure to be among the ones the runtime check matches
+    std::vector<const CompiledTypeSignatureUnit*> units;
+    for (const CompiledTypeSignatureUnit& unit : t.units) {
+        if (arePopsProven(t, unit, stack)) {
+            units.push_back(&unit);
+        }
+    }
+    for (const CharmFunction& f : body) {
+        const CompiledTypeSignature* called = nullptr;
+        if (f.functionType == DEFINED_FUNCTION) {
+            called = FunctionAnalyzer::getCompiledTypeSignature(f.functionName);
+        }
+        if (called == nullptr) {
+            inferEffect(f, stack);
+        } else if (arePushesChecked && called->units.size() == 1 && arePopsProven(*called, called->units[0], stack)) {
+            //with only one unit, what it pushes is either checked after it returns or proven
+            //when it's inlined, so that's what's there afterwards. unless the check is skipped
+            const CompiledTypeSignatureUnit& unit = called->units[0];
+            stack.resize(stack.size() > unit.pops.size() ? stack.size() - unit.pops.size() : 0);
+            for (unsigned int types : unit.pushes) {
+                stack.push_back({ types, -1 });
+            }
+        } else {
+            stack.clear();
+        }
+    }
+    for (const CompiledTypeSignatureUnit* unit : units) {
+        //this lines up with Runner::typeSignatureTock: the pushes are the top values
+        bool isUnitProven = true;
+        for (unsigned int n = 0; n < unit->pushes.size(); n++) {
+            unsigned long depth = unit->pushes.size() - 1 - n;
+            unsigned int types = depth < stack.size() ? stack[stack.size() - 1 - depth].types : ANY_TYPE;
+            if (types & ~unit->pushes[n]) {
+                isUnitProven = false;
+                break;
+            }
+        }
+        if (isUnitProven) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FunctionAnalyzer::isCallProven(const CompiledTypeSignature& t, const std::vector<TypeSlot>& stack) {
+    for (const CompiledTypeSignatureUnit& unit : t.units) {
+        if (arePopsProven(t, unit, stack)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FunctionAnalyzer::inferTypes(CHARM_LIST_TYPE& code) {
+    //walk through the code keeping track of what's known about the top of the stack. it starts
+    //out knowing nothing, and forgets everything at anything it can't follow (ex: ifthen, i, or a
+    //call that wasn't inlined). calls with a type signature that's already known to hold are
+    //inlined if possible (and if what they push is known to hold too), and otherwise have their
+    //runtime check turned off (as long as they don't push anything, which still has to be
+    //checked after they return)
+    std::vector<TypeSlot> stack;
+    CHARM_LIST_TYPE out;
+    //what's left to look at, how deeply it's been inlined, and whether it goes in the output.
+    //calls that the peephole pass has a superinstruction for aren't inlined, since the
+    //superinstruction is faster. their bodies are still followed, just not kept
+    struct PendingFunction {
+        CharmFunction f;
+        unsigned int inlineDepth;
+        bool isKept;
+    };
+    //the back is what's next, so that inlining a body is pushing it on in reverse
+    std::vector<PendingFunction> pending;
+    pending.reserve(code.size());
+    for (auto f = code.rbegin(); f != code.rend(); f++) {
+        pending.push_back({ std::move(*f), 0, true });
+    }
+    while (!pending.empty()) {
+        CharmFunction f = std::move(pending.back().f);
+        unsigned int inlineDepth = pending.back().inlineDepth;
+        bool isKept = pending.back().isKept;
+        pending.pop_back();
+        if (f.functionType == DEFINED_FUNCTION) {
+            const CompiledTypeSignature* t = FunctionAnalyzer::getCompiledTypeSignature(f.functionName);
+            if (t && f.typeChecked) {
+                if (FunctionAnalyzer::isCallProven(*t, stack)) {
+                    const CHARM_LIST_TYPE* body = inlineBody(f.functionName);
+                    bool hasSuperinstruction = body != nullptr && (enabledPasses & PEEPHOLE_PASS) &&
+                        peepholeTables().words.count(f.functionName) && isWordTrusted(f.functionName);
+                    //the same cost model as inlineCall. anything too big just stays a call
+                    bool isWorthInlining = hasSuperinstruction || (body != nullptr && codeSize(*body) <= INLINE_BUDGET);
+                    //inlining takes away the check of what it pushes too, so that has to be proven as well
+                    bool isInlineProven = body != nullptr && (!t->hasPushes || arePushesProven(*t, stack, *body));
+                    if (isKept && !hasSuperinstruction && isInlineProven && inlineDepth < MAX_TYPED_INLINE_DEPTH) {
+                        definitions[f.functionName].inlineDecisions[isWorthInlining ? TYPE_INFERENCE_INLINED_DECISION : TYPE_INFERENCE_TOO_BIG_DECISION]++;
+                    }
+                    if (isWorthInlining && isInlineProven && inlineDepth < MAX_TYPED_INLINE_DEPTH) {
+                        //now that the check is gone, there's no reason not to inline it
+                        ONLYDEBUG printf("INLINING %s, ITS TYPE SIGNATURE IS PROVEN\n", f.functionName.c_str());
+                        for (auto inlined = body->rbegin(); inlined != body->rend(); inlined++) {
+                            pending.push_back({ *inlined, inlineDepth + 1, isKept && !hasSuperinstruction });
+                        }
+                        if (isKept) {
+                            optimizationCounts[hasSuperinstruction ? "typecheck: checks removed" : "typecheck: checks removed by inlining"]++;
+                        }
+                        if (!hasSuperinstruction) {
+                            continue;
+                        }
+                        f.typeChecked = false;
+                        if (isKept) {
+                            out.push_back(std::move(f));
+                        }
+                        continue;
+                    }
+                    //what it pushes can only be checked once it's returned
+                    if (!t->hasPushes) {
+                        f.typeChecked = false;
+                        if (isKept) {
+                            optimizationCounts["typecheck: checks removed"]++;
+                        }
+                    } else if (isKept) {
+                        optimizationCounts["typecheck: checks kept"]++;
+                    }
+                } else if (isKept) {
+                    optimizationCounts["typecheck: checks kept"]++;
+                }
+            }
+        }
+        inferEffect(f, stack);
+        if (isKept) {
+            out.push_back(std::move(f));
+        }
+    }
+    for (unsigned long n = 0; n < out.size(); n++) {
+        if (out[n].functionType == LIST_FUNCTION && isQuotation(out, n)) {
+            FunctionAnalyzer::inferTypes(out[n].literalFunctions);
+        }
+    }
+    code = std::move(out);
+}
+
+//how many values checkMemo looks through before it gives up
+static const unsigned long MAX_STACK_EFFECT_STEPS = 100000;
+
+bool FunctionAnalyzer::stackEffect(const CHARM_LIST_TYPE& code, StackEffectState& state, std::vector<std::string>& callers, std::string& reason) {
+    auto pop = [&]() {
+        StackEffectValue value = { -1, nullptr };
+        if (!state.known.empty()) {
+            value = state.known.back();
+            state.known.pop_back();
+        }
+        state.height--;
+        state.lowest = std::min(state.lowest, state.height);
+        return value;
+    };
+    auto push = [&](StackEffectValue value) {
+        state.known.push_back(value);
+        state.height++;
+    };
+    for (const CharmFunction& f : code) {
+        if (++state.steps > MAX_STACK_EFFECT_STEPS) {
+            reason = "it's too big to follow";
+            return false;
+        }
+        if (f.functionType == NUMBER_FUNCTION) {
+            long index = -1;
+            if (f.numberValue.whichType == INTEGER_VALUE && f.numberValue.integerValue >= 0 && f.numberValue.integerValue < MAX_INFERRED_DEPTH) {
+                index = f.numberValue.integerValue.get_si();
+            }
+            push({ index, nullptr });
+        } else if (f.functionType == STRING_FUNCTION) {
+            push({ -1, nullptr });
+        } else if (f.functionType == LIST_FUNCTION) {
+            push({ -1, &f.literalFunctions });
+        } else if (f.functionType == FUNCTION_DEFINITION) {
+            //definitions don't touch the stack
+        } else if (f.functionName == "swap") {
+            StackEffectValue n1 = pop();
+            StackEffectValue n2 = pop();
+            if (n1.index < 0 || n2.index < 0) {
+                reason = "it uses `swap` on indices that aren't int literals";
+                return false;
+            }
+            long deepest = std::max(n1.index, n2.index);
+            while ((long)state.known.size() <= deepest) {
+                state.known.insert(state.known.begin(), { -1, nullptr });
+            }
+            state.lowest = std::min(state.lowest, state.height - 1 - deepest);
+            std::swap(state.known[state.known.size() - 1 - n1.index], state.known[state.known.size() - 1 - n2.index]);
+        } else if (f.functionName == "i") {
+            StackEffectValue list = pop();
+            if (list.list == nullptr) {
+                reason = "it uses `i` on something that isn't a list literal";
+                return false;
+            }
+            if (!FunctionAnalyzer::stackEffect(*list.list, state, callers, reason)) {
+                return false;
+            }
+        } else if (f.functionName == "ifthen") {
+            StackEffectValue falsy = pop();
+            StackEffectValue truthy = pop();
+            StackEffectValue condition = pop();
+            if (condition.list == nullptr || truthy.list == nullptr || falsy.list == nullptr) {
+                reason = "it uses `ifthen` on something that isn't a list literal";
+                return false;
+            }
+            if (!FunctionAnalyzer::stackEffect(*condition.list, state, callers, reason)) {
+                return false;
+            }
+            pop();
+            unsigned long steps = state.steps;
+            StackEffectState falsyState = state;
+            if (!FunctionAnalyzer::stackEffect(*truthy.list, state, callers, reason) ||
+                !FunctionAnalyzer::stackEffect(*falsy.list, falsyState, callers, reason)) {
+                return false;
+            }
+            if (state.height != falsyState.height) {
+                reason = "the branches of one of its `ifthen`s leave different numbers of values";
+                return false;
+            }
+            state.lowest = std::min(state.lowest, falsyState.lowest);
+            state.steps += falsyState.steps - steps;
+            //only what both branches agree on is still known
+            unsigned long common = std::min(state.known.size(), falsyState.known.size());
+            state.known.erase(state.known.begin(), state.known.end() - common);
+            for (unsigned long n = 0; n < common; n++) {
+                StackEffectValue& value = state.known[n];
+                const StackEffectValue& other = falsyState.known[falsyState.known.size() - common + n];
+                if (value.index != other.index || value.list != other.list) {
+                    value = { -1, nullptr };
+                }
+            }
+        } else if (f.functionName == "inline") {
+            //pushes a new list, with the calls in it inlined
+            pop();
+            push({ -1, nullptr });
+        } else if (BUILTIN_EFFECTS.count(f.functionName)) {
+            const BuiltinEffect& effect = BUILTIN_EFFECTS.at(f.functionName);
+            std::vector<StackEffectValue> popped;
+            for (unsigned int n = 0; n < effect.pops; n++) {
+                popped.push_back(pop());
+            }
+            for (int pushed : effect.pushes) {
+                push(pushed < 0 ? popped[-pushed - 1] : StackEffectValue { -1, nullptr });
+            }
+        } else if (std::find(callers.begin(), callers.end(), f.functionName) != callers.end()) {
+            //a recursive call. its body is being looked at already, so it's up to its type
+            //signature. if the type signature is wrong, that's caught where its body ends
+            const CompiledTypeSignature* t = FunctionAnalyzer::getCompiledTypeSignature(f.functionName);
+            bool isFixed = t != nullptr;
+            for (unsigned long n = 0; isFixed && n < t->units.size(); n++) {
+                isFixed = t->units[n].pops.size() == t->units[0].pops.size() && t->units[n].pushes.size() == t->units[0].pushes.size();
+            }
+            if (!isFixed) {
+                reason = "it calls `" + f.functionName + "` recursively, and `" + f.functionName + "` doesn't have a type signature that always pops and pushes the same number of values";
+                return false;
+            }
+            for (unsigned long n = 0; n < t->units[0].pops.size(); n++) {
+                pop();
+            }
+            for (unsigned long n = 0; n < t->units[0].pushes.size(); n++) {
+                push({ -1, nullptr });
+            }
+        } else {
+            auto definition = definitions.find(f.functionName);
+            if (SIDE_EFFECTS.count(f.functionName)) {
+                reason = "it uses `" + f.functionName + "`, which the analyzer can't follow";
+                return false;
+            } else if (definition == definitions.end() || !definition->second.hasBody) {
+                reason = "it calls `" + f.functionName + "`, which isn't defined yet";
+                return false;
+            }
+            callers.push_back(f.functionName);
+            bool isKnown = FunctionAnalyzer::stackEffect(definition->second.body, state, callers, reason);
+            callers.pop_back();
+            if (!isKnown) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -1,26 +1,275 @@
 #pragma once
 
 #include <unordered_map>
+#include <map>
 #include <string>
+#include <optional>
+#include <ostream>
+#include <memory>
 
 #include "ParserTypes.h"
 
+//in FunctionAnalyzer.cpp
+struct StackShuffle;
+struct TypeSlot;
+
+//what a value on the stack might be, as a bitmask. the type inference keeps one of these for
+//every value it knows about on the top of the stack, and type signatures are checked with them
+enum TypeMask : unsigned int {
+    INT_TYPE = 1 << 0,
+    FLOAT_TYPE = 1 << 1,
+    STRING_TYPE = 1 << 2,
+    LIST_TYPE = 1 << 3,
+    ANY_TYPE = INT_TYPE | FLOAT_TYPE | STRING_TYPE | LIST_TYPE
+};
+inline unsigned int charmTypeToTypeMask(CharmTypes t) {
+    switch (t) {
+        case TYPESIG_ANY: return ANY_TYPE;
+        case TYPESIG_LIST: return LIST_TYPE;
+        case TYPESIG_LISTSTRING: return LIST_TYPE | STRING_TYPE;
+        case TYPESIG_STRING: return STRING_TYPE;
+        case TYPESIG_INT: return INT_TYPE;
+        case TYPESIG_FLOAT: return FLOAT_TYPE;
+    }
+    return ANY_TYPE;
+}
+inline unsigned int charmFunctionToTypeMask(const CharmFunction& f) {
+    switch (f.functionType) {
+        case NUMBER_FUNCTION:
+            return f.numberValue.whichType == INTEGER_VALUE ? INT_TYPE : FLOAT_TYPE;
+        case STRING_FUNCTION:
+            return STRING_TYPE;
+        case LIST_FUNCTION:
+            return LIST_TYPE;
+        default:
+            //these never end up on the stack
+            return ANY_TYPE;
+    }
+}
+
+//a type signature with every type turned into a TypeMask ahead of time, so checking it
+//against the stack doesn't have to copy or convert anything. built by addTypeSignature
+struct CompiledTypeSignatureUnit {
+    std::vector<unsigned int> pops;
+    std::vector<unsigned int> pushes;
+};
+struct CompiledTypeSignature {
+    CharmTypeSignature signature;
+    //the pops of every unit are lined up against the top maxLength values of the stack
+    unsigned int maxLength;
+    //false if there's nothing to check after the function returns
+    bool hasPushes;
+    std::vector<CompiledTypeSignatureUnit> units;
+};
+//the runtime check keeps track of which units matched in a bitmask
+static const unsigned int MAX_TYPE_SIGNATURE_UNITS = 64;
+
+//a `memo <name> [size]` line: calls to the function are cached, keyed by the values it
+//pops. its type signature says how many values that is, and how many it pushes
+struct MemoDeclaration {
+    std::string name;
+    unsigned long capacity;
+    unsigned int pops;
+    unsigned int pushes;
+};
+
+//something the parser told an analyzer while lexing a line. modules in the include cache keep
+//the changes each of their lines made, so that replaying a module can take a fresh analyzer
+//through exactly the same states that lexing it did (see FunctionAnalyzer::journal)
+struct AnalyzerChange {
+    enum Kind {
+        COUNT_DEFINITION,
+        DEFINITION_BODY,
+        INLINE_DEFINITION,
+        TYPE_SIGNATURE,
+        MEMO
+    } kind;
+    std::string name;
+    //DEFINITION_BODY and INLINE_DEFINITION
+    CHARM_LIST_TYPE body;
+    //INLINE_DEFINITION
+    unsigned int depth = 0;
+    //TYPE_SIGNATURE
+    CharmTypeSignature typeSignature;
+    //MEMO
+    unsigned long capacity = 0;
+};
+
 class FunctionAnalyzer {
 private:
-    bool _isInlineable(std::string fName, CharmFunction f, bool ignoreTypeSignature);
-    std::unordered_map<std::string, CharmFunction> inlineDefinitions;
-    std::unordered_map<std::string, CharmTypeSignature> typeSignatures;
+    bool _isInlineable(const std::string& fName, const CharmFunction& f, bool ignoreTypeSignature);
+    std::unordered_map<std::string, CompiledTypeSignature> typeSignatures;
+    //what the inliner did with a call, for -a
+    enum InlineDecision {
+        INLINED_DECISION,
+        INLINED_INTO_QUOTATION_DECISION,
+        CALLS_CALLER_DECISION,
+        TOO_DEEP_DECISION,
+        TOO_BIG_DECISION,
+        TOO_BIG_FOR_QUOTATION_DECISION,
+        TYPE_INFERENCE_INLINED_DECISION,
+        TYPE_INFERENCE_TOO_BIG_DECISION,
+        INLINE_DECISION_COUNT
+    };
+    //everything known about a name that's been defined. it's all kept in one place so that
+    //each new definition only costs one lookup, however many definitions came before it
+    struct DefinitionInfo {
+        //how many times it's been defined. the optimizer only trusts
+        //a prelude word if it's been defined exactly once
+        unsigned int count = 0;
+        //the body of the first definition, which is the one that runs, and its codeSize
+        CHARM_LIST_TYPE body;
+        unsigned long size = 0;
+        bool hasBody = false;
+        //whether calls to it can be inlined, and how many levels of
+        //inlined calls are nested in its body
+        bool isInlineable = false;
+        unsigned int inlineDepth = 0;
+        //what it does (see Effect), only worked out when asked for
+        unsigned int effects = 0;
+        //how many calls to it got each InlineDecision
+        unsigned long long inlineDecisions[INLINE_DECISION_COUNT] = {};
+    };
+    std::unordered_map<std::string, DefinitionInfo> definitions;
+    //the body calls to `name` get replaced with, nullptr if it can't be inlined
+    const CHARM_LIST_TYPE* inlineBody(const std::string& name) const;
+    unsigned int definitionCount(const std::string& name) const;
+    unsigned int codeEffects(const CHARM_LIST_TYPE& code);
+    void analyzeEffects(const std::string& name);
+    //every `memo` declaration, by function name
+    std::unordered_map<std::string, MemoDeclaration> memos;
+    //what checkMemo knows about a value: the int literal it is (if it's small enough to be
+    //handed to swap, otherwise -1), or the list literal it is (otherwise nullptr)
+    struct StackEffectValue {
+        long index;
+        const CHARM_LIST_TYPE* list;
+    };
+    //how far the code looked at so far has moved the top of the stack, and the deepest it's
+    //reached, both relative to where it started. anything under `known` could be anything
+    struct StackEffectState {
+        std::vector<StackEffectValue> known;
+        long height = 0;
+        long lowest = 0;
+        unsigned long steps = 0;
+    };
+    //follows the code (and everything it calls) through `state`. calls to `callers` are
+    //recursive, so what their type signatures say is taken on faith. false (with why in
+    //`reason`) if there's no way to tell what the code does to the stack
+    bool stackEffect(const CHARM_LIST_TYPE& code, StackEffectState& state, std::vector<std::string>& callers, std::string& reason);
+    //goes up every time something the optimizer looks at changes (definitions, type
+    //signatures), so lists compiled before that get compiled again
+    unsigned long long generation = 0;
+
+    bool isWordTrusted(const std::string& name);
+    bool isQuotation(const CHARM_LIST_TYPE& code, unsigned long n);
+    void inlineQuotations(CHARM_LIST_TYPE& code, const std::string& caller, unsigned int depth = 0);
+    void spliceQuotations(CHARM_LIST_TYPE& code);
+    void compileBranches(CHARM_LIST_TYPE& code);
+    bool matchPattern(const CHARM_LIST_TYPE& code, unsigned long start, const CHARM_LIST_TYPE& pattern, CHARM_LIST_TYPE& operands);
+    bool isCallProven(const CompiledTypeSignature& t, const std::vector<TypeSlot>& stack);
+    //whether running `body` with `stack` under it leaves what `t` says it pushes
+    bool arePushesProven(const CompiledTypeSignature& t, std::vector<TypeSlot> stack, const CHARM_LIST_TYPE& body);
+    void inferTypes(CHARM_LIST_TYPE& code);
+    void fold(CHARM_LIST_TYPE& code);
+    void peephole(CHARM_LIST_TYPE& code);
+    unsigned long shuffleStep(const CHARM_LIST_TYPE& code, unsigned long n, StackShuffle& shuffle);
+    void permute(CHARM_LIST_TYPE& code);
 public:
     FunctionAnalyzer();
 
-    bool isInlinable(CharmFunction f);
-    bool isInlinableIgnoringTypeSignature(CharmFunction f);
-    bool isTailCallRecursive(CharmFunction f);
+    //while this isn't nullptr, every definition, type signature and memo declaration the
+    //analyzer is told about is added to it too
+    std::vector<AnalyzerChange>* journal = nullptr;
+    //makes a change from a journal again
+    void replay(const AnalyzerChange& change);
+    //the namespace the code this analyzer lexes gets linked into (see ModuleCache::link).
+    //the analyzer only ever sees names as they were written, so names that come back from
+    //the runner need it taken off with unlinkedName before they're looked up
+    std::string ns;
+    std::string unlinkedName(const std::string& name) const;
+
+    bool isInlinable(const CharmFunction& f);
+    bool isInlinableIgnoringTypeSignature(const CharmFunction& f);
+    bool isTailCallRecursive(const CharmFunction& f);
 
-    void addToInlineDefinitions(CharmFunction f);
-    bool doInline(CHARM_LIST_TYPE& out, CharmFunction currentFunction);
+    //definitions are first wins at runtime (see Runner::addFunctionDefinition), so only the
+    //first definition of a name is ever inlined. `depth` is how deeply nested the calls that
+    //were inlined into its body go
+    void addToInlineDefinitions(const CharmFunction& f, unsigned int depth = 0);
+    void countDefinition(const std::string& name);
+    bool doInline(CHARM_LIST_TYPE& out, const CharmFunction& currentFunction);
+
+    //where the inliner is inlining into: the definition being parsed (empty for top level
+    //code), and how deeply nested the calls inlined into it so far go
+    struct InlineSite {
+        std::string caller;
+        unsigned int depth = 0;
+    };
+    //inlines a call to an inlineable function if the cost model says it's worth it. calls
+    //inside quotations are allowed to be bigger, since those are usually loop bodies
+    bool inlineCall(CHARM_LIST_TYPE& out, const CharmFunction& f, InlineSite& site, bool inQuotation);
+    //what a function can do besides pushing and popping values on the current stack.
+    //a function with none of these only depends on what it pops
+    enum Effect : unsigned int {
+        READS_REFS_EFFECT = 1 << 0,
+        WRITES_REFS_EFFECT = 1 << 1,
+        //switches or creates stacks
+        STACKS_EFFECT = 1 << 2,
+        //p, pstring, newline and getline
+        IO_EFFECT = 1 << 3,
+        FFI_EFFECT = 1 << 4,
+        //def and include
+        DEFINES_EFFECT = 1 << 5,
+        //runs lists from the stack or a ref, or calls something the analyzer doesn't know about
+        UNKNOWN_EFFECT = 1 << 6
+    };
+    //every function's effects include the effects of everything it calls
+    void addDefinitionBody(const std::string& name, const CHARM_LIST_TYPE& body);
+    unsigned int getEffects(const std::string& name);
+    static std::string effectsToString(unsigned int e);
+    static const unsigned long DEFAULT_MEMO_CAPACITY = 4096;
+    void addMemo(const std::string& name, unsigned long capacity);
+    //dies if `name` was declared with memo, but can do anything besides use the stack, or its
+    //body doesn't pop and push exactly what its type signature says
+    void checkMemo(const std::string& name);
+    //nullptr if `name` isn't memoized
+    const MemoDeclaration* getMemo(const std::string& name) const;
+    std::vector<MemoDeclaration> getMemos();
+    //prints what's known about a function, for -a
+    void printAnalysis(const std::string& name, std::ostream& out);
 
     void addTypeSignature(CharmTypeSignature t);
     std::optional<CharmTypeSignature> getTypeSignature(std::string name);
+    //nullptr if `name` has no type signature
+    const CompiledTypeSignature* getCompiledTypeSignature(const std::string& name) const;
+    std::vector<CharmTypeSignature> getTypeSignatures();
     static unsigned int maxTypeSignatureLength(CharmTypeSignature t);
+
+    //optimization passes run after inlining, on definition bodies and top level code.
+    //every pass can be turned off with --disable-opt, to compare against unoptimized code
+    enum OptimizationPass {
+        PEEPHOLE_PASS = 1 << 0,
+        PERMUTE_PASS = 1 << 1,
+        FOLD_PASS = 1 << 2,
+        TYPECHECK_PASS = 1 << 3,
+        INLINE_PASS = 1 << 4,
+        BRANCH_PASS = 1 << 5
+    };
+    static unsigned int enabledPasses;
+    //whether what every call with a type signature pushes is checked when it returns. with
+    //--typecheck=sample:N or off it isn't, so the type inference can't count on it
+    static bool arePushesChecked;
+    //returns false if there's no pass called `name`
+    static bool setPassEnabled(const std::string& name, bool enabled);
+    //`definitionName` is the definition the code is the body of, if any
+    void optimize(CHARM_LIST_TYPE& code, const std::string& definitionName = "");
+    //the optimized code for a list that's about to be run, built once and shared by every
+    //copy of the list. nullptr if the list doesn't carry a cache (see CharmFunction::compiled)
+    std::shared_ptr<const CHARM_LIST_TYPE> compileQuotation(const CharmFunction& list);
+    //for changes the analyzer can't see on its own, like `ffi` shadowing a definition
+    void invalidateCompiledQuotations();
+
+    //how many times each rewrite has fired, for --opt-report
+    static std::map<std::string, unsigned long long> optimizationCounts;
+    static void printOptimizationReport(std::ostream& out);
 };
@@ -0,0 +1,515 @@
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <filesystem>
+#include <unistd.h>
+
+#include "ModuleCache.h"
+#include "Parser.h"
+#include "Runner.h"
+#include "Tracer.h"
+#include "Error.h"
+#include "Debug.h"
+
+ModuleCache::ModuleCache() {
+	//pick a directory for the on disk cache. if none of these are set
+	//(or the directory can't be made later) the cache is just kept in memory
+	const char* charmCache = std::getenv("CHARM_CACHE_DIR");
+	const char* xdgCache = std::getenv("XDG_CACHE_HOME");
+	const char* home = std::getenv("HOME");
+	if (charmCache != nullptr) {
+		cacheDirectory = charmCache;
+	} else if (xdgCache != nullptr && *xdgCache != '\0') {
+		cacheDirectory = std::string(xdgCache) + "/charm";
+	} else if (home != nullptr && *home != '\0') {
+		cacheDirectory = std::string(home) + "/.cache/charm";
+	}
+}
+
+unsigned long long ModuleCache::hashContents(const std::string& contents) {
+	unsigned long long hash = 14695981039346656037ULL;
+	for (unsigned char c : contents) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+std::string ModuleCache::moduleKey(const std::string& path, const std::string& ns) {
+	//the same file can be included from different working directories, so
+	//always key on the absolute path
+	std::error_code e;
+	std::string absolutePath = std::filesystem::weakly_canonical(path, e).string();
+	if (e) {
+		absolutePath = path;
+	}
+	return absolutePath + '\0' + ns;
+}
+
+std::string ModuleCache::diskPath(const std::string& key) {
+	std::stringstream out;
+	out << cacheDirectory << "/" << std::hex << hashContents(key) << ".charmc";
+	return out.str();
+}
+
+/*************************************
+SERIALIZATION
+*************************************/
+void ModuleCache::writeString(std::ostream& out, const std::string& s) {
+	out << s.size() << ' ' << s << '\n';
+}
+
+std::string ModuleCache::readString(std::istream& in) {
+	unsigned long long size;
+	in >> size;
+	//skip the space after the length
+	in.get();
+	std::string out(size, '\0');
+	in.read(&out[0], size);
+	if (!in) {
+		throw std::runtime_error("Truncated module cache file");
+	}
+	return out;
+}
+
+void ModuleCache::writeFunction(std::ostream& out, const CharmFunction& f) {
+	out << f.functionType << ' ';
+	switch (f.functionType) {
+		case NUMBER_FUNCTION:
+		out << f.numberValue.whichType << ' ';
+		if (f.numberValue.whichType == INTEGER_VALUE) {
+			writeString(out, f.numberValue.integerValue.get_str());
+		} else {
+			//store floats as 0.<digits>e<exponent>, which mpf_class reads back exactly
+			long exponent;
+			std::string digits = f.numberValue.floatValue.get_str(exponent);
+			if (digits == "") {
+				writeString(out, "0");
+			} else if (digits.front() == '-') {
+				writeString(out, "-0." + digits.substr(1) + "e" + std::to_string(exponent));
+			} else {
+				writeString(out, "0." + digits + "e" + std::to_string(exponent));
+			}
+		}
+		break;
+
+		case STRING_FUNCTION:
+		writeString(out, f.stringValue);
+		break;
+
+		case DEFINED_FUNCTION:
+		writeString(out, f.functionName);
+		out << f.typeChecked << ' ';
+		//superinstructions carry their operands in literalFunctions
+		out << f.literalFunctions.size() << '\n';
+		for (const CharmFunction& child : f.literalFunctions) {
+			writeFunction(out, child);
+		}
+		break;
+
+		case FUNCTION_DEFINITION:
+		writeString(out, f.functionName);
+		out << f.definitionInfo.inlineable << ' ' << f.definitionInfo.tailCallRecursive << ' ';
+		//fallthrough, definitions hold their body in literalFunctions just like lists
+		case LIST_FUNCTION:
+		out << f.literalFunctions.size() << '\n';
+		for (const CharmFunction& child : f.literalFunctions) {
+			writeFunction(out, child);
+		}
+		break;
+	}
+}
+
+CharmFunction ModuleCache::readFunction(std::istream& in) {
+	CharmFunction f;
+	int functionType;
+	in >> functionType;
+	f.functionType = static_cast<CharmFunctionType>(functionType);
+	switch (f.functionType) {
+		case NUMBER_FUNCTION: {
+			int whichType;
+			in >> whichType;
+			f.numberValue.whichType = static_cast<CharmNumberType>(whichType);
+			if (f.numberValue.whichType == INTEGER_VALUE) {
+				f.numberValue.integerValue = mpz_class(readString(in));
+			} else {
+				f.numberValue.floatValue = mpf_class(readString(in));
+			}
+			break;
+		}
+
+		case STRING_FUNCTION:
+		f.stringValue = readString(in);
+		break;
+
+		case FUNCTION_DEFINITION:
+		f.functionName = readString(in);
+		in >> f.definitionInfo.inlineable >> f.definitionInfo.tailCallRecursive;
+		//fallthrough
+		case DEFINED_FUNCTION:
+		if (f.functionType == DEFINED_FUNCTION) {
+			f.functionName = readString(in);
+			in >> f.typeChecked;
+		}
+		//fallthrough
+		case LIST_FUNCTION: {
+			if (f.functionType == LIST_FUNCTION) {
+				f.compiled = std::make_shared<CompiledQuotation>();
+			}
+			unsigned long long size;
+			in >> size;
+			for (unsigned long long n = 0; n < size; n++) {
+				f.literalFunctions.push_back(readFunction(in));
+			}
+			break;
+		}
+
+		default:
+		throw std::runtime_error("Corrupt module cache file");
+	}
+	if (!in) {
+		throw std::runtime_error("Truncated module cache file");
+	}
+	return f;
+}
+
+void ModuleCache::writeTypeSignature(std::ostream& out, const CharmTypeSignature& t) {
+	writeString(out, t.functionName);
+	out << t.units.size() << '\n';
+	for (const CharmTypeSignatureUnit& unit : t.units) {
+		out << unit.pops.size();
+		for (CharmTypes type : unit.pops) {
+			out << ' ' << type;
+		}
+		out << ' ' << unit.pushes.size();
+		for (CharmTypes type : unit.pushes) {
+			out << ' ' << type;
+		}
+		out << '\n';
+	}
+}
+
+CharmTypeSignature ModuleCache::readTypeSignature(std::istream& in) {
+	CharmTypeSignature t;
+	t.functionName = readString(in);
+	unsigned long long unitCount;
+	in >> unitCount;
+	for (unsigned long long u = 0; u < unitCount && in; u++) {
+		CharmTypeSignatureUnit unit;
+		unsigned long long count;
+		int type;
+		in >> count;
+		for (unsigned long long i = 0; i < count && in; i++) {
+			in >> type;
+			unit.pops.push_back(static_cast<CharmTypes>(type));
+		}
+		in >> count;
+		for (unsigned long long i = 0; i < count && in; i++) {
+			in >> type;
+			unit.pushes.push_back(static_cast<CharmTypes>(type));
+		}
+		t.units.push_back(unit);
+	}
+	return t;
+}
+
+void ModuleCache::writeChange(std::ostream& out, const AnalyzerChange& change) {
+	//every field is written whatever the kind is, the ones it doesn't use are just empty
+	out << change.kind << ' ';
+	writeString(out, change.name);
+	out << change.depth << ' ' << change.capacity << ' ' << change.body.size() << '\n';
+	for (const CharmFunction& f : change.body) {
+		writeFunction(out, f);
+	}
+	writeTypeSignature(out, change.typeSignature);
+}
+
+AnalyzerChange ModuleCache::readChange(std::istream& in) {
+	int kind;
+	in >> kind;
+	if (kind < AnalyzerChange::COUNT_DEFINITION || kind > AnalyzerChange::MEMO) {
+		throw std::runtime_error("Corrupt module cache file");
+	}
+	AnalyzerChange change = { static_cast<AnalyzerChange::Kind>(kind), readString(in) };
+	unsigned long long bodySize;
+	in >> change.depth >> change.capacity >> bodySize;
+	for (unsigned long long n = 0; n < bodySize && in; n++) {
+		change.body.push_back(readFunction(in));
+	}
+	change.typeSignature = readTypeSignature(in);
+	return change;
+}
+
+void ModuleCache::writeSymbols(std::ostream& out, const std::set<std::string>& symbols) {
+	out << symbols.size() << '\n';
+	for (const std::string& symbol : symbols) {
+		writeString(out, symbol);
+	}
+}
+
+std::set<std::string> ModuleCache::readSymbols(std::istream& in) {
+	std::set<std::string> out;
+	unsigned long long size;
+	in >> size;
+	for (unsigned long long n = 0; n < size; n++) {
+		out.insert(readString(in));
+	}
+	return out;
+}
+
+void ModuleCache::writeModule(std::ostream& out, const CachedModule& module) {
+	//modules built by an interpreter that doesn't inline (or optimize the same way)
+	//can't be shared with one that does
+	out << "charm-module " << FORMAT_VERSION << ' ' << OPTIMIZE_INLINE << ' ' << FunctionAnalyzer::enabledPasses << ' ' << FunctionAnalyzer::arePushesChecked << '\n';
+	out << module.contentHash << '\n';
+	writeString(out, module.path);
+	writeString(out, module.ns);
+	writeSymbols(out, module.globalSymbols);
+	writeSymbols(out, module.localSymbols);
+	out << module.lines.size() << '\n';
+	for (const CachedLine& line : module.lines) {
+		out << line.changes.size() << '\n';
+		for (const AnalyzerChange& change : line.changes) {
+			writeChange(out, change);
+		}
+		out << line.code.size() << '\n';
+		for (const CharmFunction& f : line.code) {
+			writeFunction(out, f);
+		}
+	}
+}
+
+std::shared_ptr<CachedModule> ModuleCache::readModule(std::istream& in) {
+	auto module = std::make_shared<CachedModule>();
+	std::string magic;
+	unsigned int version;
+	bool inlined;
+	unsigned int passes;
+	bool pushesChecked;
+	in >> magic >> version >> inlined >> passes >> pushesChecked;
+	if (magic != "charm-module" || version != FORMAT_VERSION || inlined != OPTIMIZE_INLINE || passes != FunctionAnalyzer::enabledPasses || pushesChecked != FunctionAnalyzer::arePushesChecked) {
+		throw std::runtime_error("Module cache file from a different version of charm");
+	}
+	in >> module->contentHash;
+	module->path = readString(in);
+	module->ns = readString(in);
+	module->globalSymbols = readSymbols(in);
+	module->localSymbols = readSymbols(in);
+	unsigned long long lineCount;
+	in >> lineCount;
+	for (unsigned long long n = 0; n < lineCount && in; n++) {
+		CachedLine line;
+		unsigned long long count;
+		in >> count;
+		for (unsigned long long c = 0; c < count && in; c++) {
+			line.changes.push_back(readChange(in));
+		}
+		in >> count;
+		for (unsigned long long c = 0; c < count && in; c++) {
+			line.code.push_back(readFunction(in));
+		}
+		module->lines.push_back(std::move(line));
+	}
+	if (!in) {
+		throw std::runtime_error("Truncated module cache file");
+	}
+	return module;
+}
+
+std::shared_ptr<CachedModule> ModuleCache::loadFromDisk(const std::string& key, const std::string& path, const std::string& ns, unsigned long long contentHash) {
+	if (cacheDirectory == "") {
+		return nullptr;
+	}
+	std::ifstream in(diskPath(key), std::ios::binary);
+	if (!in) {
+		return nullptr;
+	}
+	try {
+		auto module = readModule(in);
+		//two keys can hash to the same file name, so check that this is really the module we want
+		if (module->contentHash != contentHash || moduleKey(module->path, module->ns) != key) {
+			return nullptr;
+		}
+		ONLYDEBUG printf("LOADED MODULE %s FROM THE DISK CACHE\n", path.c_str());
+		return module;
+	} catch (std::exception& e) {
+		//a bad cache file is never fatal, we just rebuild the module
+		ONLYDEBUG printf("IGNORING BAD MODULE CACHE FILE FOR %s: %s\n", path.c_str(), e.what());
+		return nullptr;
+	}
+}
+
+void ModuleCache::storeToDisk(const std::string& key, const CachedModule& module) {
+	if (cacheDirectory == "") {
+		return;
+	}
+	if (!isCacheDirectoryMade) {
+		std::error_code e;
+		std::filesystem::create_directories(cacheDirectory, e);
+		if (e) {
+			ONLYDEBUG printf("COULDN'T CREATE MODULE CACHE DIRECTORY %s\n", cacheDirectory.c_str());
+			cacheDirectory = "";
+			return;
+		}
+		isCacheDirectoryMade = true;
+	}
+	//write to a temporary file and rename it into place so that
+	//a concurrently running interpreter never reads half a module
+	std::string finalPath = diskPath(key);
+	std::string tempPath = finalPath + ".tmp" + std::to_string(getpid());
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out) {
+			return;
+		}
+		writeModule(out, module);
+		if (!out) {
+			out.close();
+			std::remove(tempPath.c_str());
+			return;
+		}
+	}
+	std::error_code e;
+	std::filesystem::rename(tempPath, finalPath, e);
+	if (e) {
+		std::remove(tempPath.c_str());
+	}
+}
+
+/*************************************
+LINKING
+*************************************/
+void ModuleCache::link(CharmFunction& f, CachedModule& module, Runner* r) {
+	if (f.functionType == LIST_FUNCTION) {
+		for (CharmFunction& currentFunction : f.literalFunctions) {
+			link(currentFunction, module, r);
+		}
+		//renaming the calls changes what the list does, so don't share its old compiled code
+		f.compiled = std::make_shared<CompiledQuotation>();
+	} else if (f.functionType == FUNCTION_DEFINITION) {
+		f.functionName = module.ns + f.functionName;
+		for (CharmFunction& currentFunction : f.literalFunctions) {
+			link(currentFunction, module, r);
+		}
+	} else if (f.functionType == DEFINED_FUNCTION) {
+		//don't rename the function if it was defined globally outside of this file
+		//(aka: in the prelude or as a builtin). functions from the module itself
+		//are never global, because their definitions got the namespace prepended
+		if (r->isGlobalSymbol(f.functionName)) {
+			module.globalSymbols.insert(f.functionName);
+		} else {
+			module.localSymbols.insert(f.functionName);
+			f.functionName = module.ns + f.functionName;
+		}
+		//the code a superinstruction falls back on needs linking too
+		for (CharmFunction& currentFunction : f.literalFunctions) {
+			link(currentFunction, module, r);
+		}
+	}
+}
+
+bool ModuleCache::isLinkValid(const CachedModule& module, Runner* r) {
+	//an include with no namespace doesn't rename anything
+	if (module.ns == "") {
+		return true;
+	}
+	for (const std::string& symbol : module.globalSymbols) {
+		if (!r->isGlobalSymbol(symbol)) {
+			return false;
+		}
+	}
+	for (const std::string& symbol : module.localSymbols) {
+		if (r->isGlobalSymbol(symbol)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::shared_ptr<CachedModule> ModuleCache::build(const std::string& path, const std::string& ns, const std::string& contents, Runner* r) {
+	auto module = std::make_shared<CachedModule>();
+	module->path = path;
+	module->ns = ns;
+	module->contentHash = hashContents(contents);
+	//lex and run the file line by line, just like the main file. each line is linked
+	//into the namespace right before it runs, which is the only time the namespace is
+	//ever looked at. the linked result can then be replayed without doing it again
+	Parser parser = Parser();
+	FunctionAnalyzer* fA = parser.getFunctionAnalyzer();
+	fA->ns = ns;
+	for (auto& line : parser.prelex(contents)) {
+		CachedLine cachedLine;
+		//only what lexing does to the analyzer is kept. whatever running the line does
+		//to it (`def`) happens again when the line is replayed
+		fA->journal = &cachedLine.changes;
+		auto lexed = parser.lexPrelexed(line);
+		fA->journal = nullptr;
+		if (ns != "") {
+			for (CharmFunction& f : lexed.first) {
+				link(f, *module, r);
+			}
+		}
+		if (!cachedLine.changes.empty() || !lexed.first.empty()) {
+			cachedLine.code = lexed.first;
+			module->lines.push_back(std::move(cachedLine));
+		}
+		r->run(lexed);
+	}
+	return module;
+}
+
+void ModuleCache::replay(const CachedModule& module, Runner* r) {
+	//a fresh analyzer is taken through the same changes the parser's analyzer went through
+	//when the module was built, line by line. so everything that looks at it while the module
+	//runs (`inline`, `def`, lists compiled at runtime, memos, type checks) sees what it did then
+	FunctionAnalyzer fA;
+	fA.ns = module.ns;
+	for (const CachedLine& line : module.lines) {
+		for (const AnalyzerChange& change : line.changes) {
+			fA.replay(change);
+		}
+		r->run(std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*>(line.code, &fA));
+	}
+}
+
+void ModuleCache::include(const std::string& path, const std::string& ns, Runner* r) {
+	TraceScope traceScope(r->tracer, "include", path);
+	std::ifstream importFile(path, std::ios::binary);
+	if (!importFile) {
+		runtime_die("`include` couldn't open " + path + ".");
+	}
+	std::stringstream contentsS;
+	contentsS << importFile.rdbuf();
+	std::string contents = contentsS.str();
+	unsigned long long contentHash = hashContents(contents);
+
+	std::string key = moduleKey(path, ns);
+	auto iter = modules.find(key);
+	std::shared_ptr<CachedModule> module;
+	if (iter != modules.end() && iter->second->contentHash == contentHash) {
+		ONLYDEBUG printf("MODULE %s WAS ALREADY IN THE MEMORY CACHE\n", path.c_str());
+		module = iter->second;
+	} else {
+		module = loadFromDisk(key, path, ns, contentHash);
+	}
+
+	//the names the module was linked against might have been defined (or not)
+	//since it was cached. if so, it has to be linked again
+	if (module && !isLinkValid(*module, r)) {
+		ONLYDEBUG printf("MODULE %s NEEDS TO BE RELINKED\n", path.c_str());
+		module = nullptr;
+	}
+
+	if (module) {
+		modules[key] = module;
+		//hold on to our own reference, the module can be replaced by a nested include
+		replay(*module, r);
+	} else {
+		//building the module runs it, so there's nothing left to do afterwards. if any line
+		//of it fails, the error goes straight through and nothing is cached
+		module = build(path, ns, contents, r);
+		modules[key] = module;
+		storeToDisk(key, *module);
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <set>
+#include <iostream>
+#include <unordered_map>
+
+#include "ParserTypes.h"
+#include "FunctionAnalyzer.h"
+
+//in Runner.h
+class Runner;
+
+//one line of a module: everything lexing it told the parser's analyzer (definitions, type
+//signatures, memo declarations), and the lexed, inlined and namespaced code it turned into
+struct CachedLine {
+	std::vector<AnalyzerChange> changes;
+	CHARM_LIST_TYPE code;
+};
+
+//a module is everything that `include` produces from a single file. replaying one of these
+//is equivalent to lexing and running the file line by line.
+struct CachedModule {
+	std::string path;
+	std::string ns;
+	unsigned long long contentHash;
+	std::vector<CachedLine> lines;
+	//how every name in the module was resolved when it was linked. names in
+	//globalSymbols were left alone, names in localSymbols got the namespace
+	//prepended. if either set resolves differently now, the module is relinked
+	std::set<std::string> globalSymbols;
+	std::set<std::string> localSymbols;
+};
+
+class ModuleCache {
+private:
+	//bump this whenever the on disk layout or the code the parser generates changes
+	static const unsigned int FORMAT_VERSION = 13;
+
+	//keyed by path + namespace, the content hash is checked on lookup
+	std::unordered_map<std::string, std::shared_ptr<CachedModule>> modules;
+	//empty if there's nowhere to write the cache to. it's only made once something is written
+	//to it, so runs that never include anything don't touch the disk
+	std::string cacheDirectory;
+	bool isCacheDirectoryMade = false;
+
+	static std::string moduleKey(const std::string& path, const std::string& ns);
+	std::string diskPath(const std::string& key);
+
+	std::shared_ptr<CachedModule> loadFromDisk(const std::string& key, const std::string& path, const std::string& ns, unsigned long long contentHash);
+	void storeToDisk(const std::string& key, const CachedModule& module);
+	static void link(CharmFunction& f, CachedModule& module, Runner* r);
+	static bool isLinkValid(const CachedModule& module, Runner* r);
+	std::shared_ptr<CachedModule> build(const std::string& path, const std::string& ns, const std::string& contents, Runner* r);
+	static void replay(const CachedModule& module, Runner* r);
+
+	static void writeString(std::ostream& out, const std::string& s);
+	static std::string readString(std::istream& in);
+	static void writeFunction(std::ostream& out, const CharmFunction& f);
+	static CharmFunction readFunction(std::istream& in);
+	static void writeTypeSignature(std::ostream& out, const CharmTypeSignature& t);
+	static CharmTypeSignature readTypeSignature(std::istream& in);
+	static void writeChange(std::ostream& out, const AnalyzerChange& change);
+	static AnalyzerChange readChange(std::istream& in);
+	static void writeSymbols(std::ostream& out, const std::set<std::string>& symbols);
+	static std::set<std::string> readSymbols(std::istream& in);
+	static void writeModule(std::ostream& out, const CachedModule& module);
+	static std::shared_ptr<CachedModule> readModule(std::istream& in);
+public:
+	ModuleCache();
+
+	//64 bit FNV-1a, good enough to notice that a file changed
+	static unsigned long long hashContents(const std::string& contents);
+
+	//run the file at `path` with every definition placed in `ns`. this is the
+	//entire implementation of the `include` builtin
+	void include(const std::string& path, const std::string& ns, Runner* r);
+};
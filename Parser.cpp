@@ -1,6 +1,9 @@
 #include <vector>
 #include <sstream>
 #include <utility>
+#include <thread>
+#include <atomic>
+#include <system_error>
 
 #include "Parser.h"
 #include "ParserTypes.h"
@@ -99,6 +102,36 @@ bool Parser::isLineTypeSignature(std::string line) {
 	return false;
 }
 
+bool Parser::isLineMemo(std::string line) {
+	//almost every line can be ruled out without splitting it up
+	if (line.find("memo") == std::string::npos) {
+		return false;
+	}
+	std::stringstream lineS(line);
+	std::vector<std::string> tokens;
+	std::string f;
+	while (lineS >> f) {
+		tokens.push_back(f);
+	}
+	return tokens.size() >= 2 && tokens.size() <= 3 && tokens[0] == "memo";
+}
+
+void Parser::parseMemo(std::string line) {
+	std::stringstream lineS(line);
+	std::string memo;
+	std::string name;
+	unsigned long capacity = FunctionAnalyzer::DEFAULT_MEMO_CAPACITY;
+	lineS >> memo >> name;
+	std::string size;
+	if (lineS >> size) {
+		if (size.find_first_not_of("0123456789") != std::string::npos || size.size() > 18) {
+			parsetime_die("The size in `memo " + name + "` has to be a positive integer.");
+		}
+		capacity = std::stoul(size);
+	}
+	fA.addMemo(name, capacity);
+}
+
 CharmTypes Parser::tokenToType(std::string token) {
     if (token == "any") {
         return TYPESIG_ANY;
@@ -128,40 +161,43 @@ CharmTypeSignature Parser::parseTypeSignature(std::string line) {
 	Parser::rtrim(typeSignature.functionName);
 	Parser::ltrim(typeSignature.functionName);
 
-    ParseUnit:
-    CharmTypeSignatureUnit unit;
 	std::string typeStringRest = line.substr(colonIndex + 2);
-    std::string typeStringToken;
+	std::string typeStringToken;
+	//every alternative (split up by |) is its own unit
+	bool isAnotherUnit = true;
+	while (isAnotherUnit) {
+		isAnotherUnit = false;
+		CharmTypeSignatureUnit unit;
 
-    //first, parse the popped types
-    while (Parser::advanceParse(typeStringToken, typeStringRest)) {
-        if (typeStringToken == "") {
-            continue;
-        }
-        if (typeStringToken == "->") {
-            break;
-        }
-        if (typeStringToken == "|") {
-            //this is only valid after an entire type signature has been specified.
-            //thus, using it before a -> is invalid
-            parsetime_die("Type alternative specified before completion of type.");
-        }
-        unit.pops.push_back(Parser::tokenToType(typeStringToken));
-    }
+		//first, parse the popped types
+		while (Parser::advanceParse(typeStringToken, typeStringRest)) {
+			if (typeStringToken == "") {
+				continue;
+			}
+			if (typeStringToken == "->") {
+				break;
+			}
+			if (typeStringToken == "|") {
+				//this is only valid after an entire type signature has been specified.
+				//thus, using it before a -> is invalid
+				parsetime_die("Type alternative specified before completion of type.");
+			}
+			unit.pops.push_back(Parser::tokenToType(typeStringToken));
+		}
 
-    //then, parse the pushed types
-    while (Parser::advanceParse(typeStringToken, typeStringRest)) {
-        if (typeStringToken == "") {
-            continue;
-        }
-        if (typeStringToken == "|") {
-            Parser::advanceParse(typeStringToken, typeStringRest);
-            typeSignature.units.push_back(unit);
-            goto ParseUnit;
-        }
-        unit.pushes.push_back(Parser::tokenToType(typeStringToken));
-    }
-    typeSignature.units.push_back(unit);
+		//then, parse the pushed types
+		while (Parser::advanceParse(typeStringToken, typeStringRest)) {
+			if (typeStringToken == "") {
+				continue;
+			}
+			if (typeStringToken == "|") {
+				isAnotherUnit = true;
+				break;
+			}
+			unit.pushes.push_back(Parser::tokenToType(typeStringToken));
+		}
+		typeSignature.units.push_back(unit);
+	}
 	return typeSignature;
 }
 
@@ -176,47 +212,62 @@ CharmFunctionType Parser::recognizeFunction(std::string s) {
 	return DEFINED_FUNCTION;
 }
 
-CharmFunctionDefinitionInfo Parser::analyzeDefinition(CharmFunction f) {
+CharmFunctionDefinitionInfo Parser::analyzeDefinition(const CharmFunction& f) {
 	CharmFunctionDefinitionInfo out;
+	fA.countDefinition(f.functionName);
+	fA.addDefinitionBody(f.functionName, f.literalFunctions);
 	//first, we fill in the info and see if the function is not recursive/inlineable
 	out.inlineable = fA.isInlinable(f);
 	//then we fill in the inlineDefinitions deque (ignoring type signatures), for parsing future DEFINED_FUNCTIONs or for using the `inline` function
 	if (fA.isInlinableIgnoringTypeSignature(f)) {
-		fA.addToInlineDefinitions(f);
+		fA.addToInlineDefinitions(f, inlineSite.depth);
 	}
 	out.tailCallRecursive = fA.isTailCallRecursive(f);
 	return out;
 }
 
-CharmFunction Parser::parseDefinition(std::string line) {
+CharmFunction Parser::parseDefinitionName(std::string line, std::string& body) {
 	//if there was a function definition, do some weird stuff
 	//set functionType to FUNCTION_DEFINITION (duh)
 	//take the first token before the := and set it to the functionName
-	//take all the tokens after the :=, parse them, and make them the literalFunctions
+	//the tokens after the := are handed back in body to be parsed by the caller
 	CharmFunction currentFunction;
 	currentFunction.functionType = FUNCTION_DEFINITION;
-	std::pair<std::string, std::string> nameAndDef;
 
 	//this is called only if Parser::isLineFunctionDefinition was true, so that guarentees that
 	//the string " := " is somewhere in this string
 	auto equalsIndex = line.find(":=");
-	nameAndDef.first = line.substr(0, equalsIndex);
-	Parser::rtrim(nameAndDef.first);
-	Parser::ltrim(nameAndDef.first);
-	nameAndDef.second = line.substr(equalsIndex + 2);
-	//now we set the stuff!
-	currentFunction.functionName = nameAndDef.first;
+	currentFunction.functionName = line.substr(0, equalsIndex);
+	Parser::rtrim(currentFunction.functionName);
+	Parser::ltrim(currentFunction.functionName);
+	body = line.substr(equalsIndex + 2);
 	ONLYDEBUG printf("FUNCTION IS NAMED %s\n", currentFunction.functionName.c_str());
-	ONLYDEBUG printf("FUNCTION BODY IS %s\n", nameAndDef.second.c_str());
-	currentFunction.literalFunctions = Parser::lex(nameAndDef.second).first;
-	//we outta here!
+	ONLYDEBUG printf("FUNCTION BODY IS %s\n", body.c_str());
+	return currentFunction;
+}
 
-	//then, we analyze the function before returning it
+void Parser::finishDefinition(CharmFunction& currentFunction) {
+	//analyze the function once its body has been parsed
 	CharmFunctionDefinitionInfo functionInfo = Parser::analyzeDefinition(currentFunction);
+	fA.checkMemo(currentFunction.functionName);
 	currentFunction.definitionInfo = functionInfo;
-    definitionInfoCache[currentFunction.functionName] = functionInfo;
+	//like the definitions themselves, the first one wins
+	definitionInfoCache.emplace(currentFunction.functionName, functionInfo);
+	//the analyzer already has its own unoptimized copy of the body for inlining, so
+	//only the copy that gets run is optimized
+	fA.optimize(currentFunction.literalFunctions, currentFunction.functionName);
+	inlineSite = FunctionAnalyzer::InlineSite();
 	ONLYDEBUG printf("IS %s INLINEABLE? %s\n", currentFunction.functionName.c_str(), currentFunction.definitionInfo.inlineable ? "Yes" : "No");
 	ONLYDEBUG printf("IS %s TAIL CALL RECURSIVE? %s\n", currentFunction.functionName.c_str(), currentFunction.definitionInfo.tailCallRecursive ? "Yes" : "No");
+}
+
+CharmFunction Parser::parseDefinition(std::string line) {
+	std::string body;
+	CharmFunction currentFunction = Parser::parseDefinitionName(line, body);
+	inlineSite = { currentFunction.functionName, 0 };
+	currentFunction.literalFunctions = Parser::lexAskToInline(body, true).first;
+	//we outta here!
+	Parser::finishDefinition(currentFunction);
 	return currentFunction;
 }
 
@@ -299,6 +350,7 @@ CharmFunction Parser::parseStringFunction(std::string& token, std::string& rest)
 CharmFunction Parser::parseListFunction(std::string& token, std::string& rest) {
 	CharmFunction out;
 	out.functionType = LIST_FUNCTION;
+	out.compiled = std::make_shared<CompiledQuotation>();
 	//and not a string. this time, we look for a "]"
 	//to end the list (or a new line. that works too)
 	//first, we have to make another string with the contents
@@ -332,6 +384,19 @@ CharmFunction Parser::parseListFunction(std::string& token, std::string& rest) {
 	return out;
 }
 
+bool Parser::tryInline(CHARM_LIST_TYPE& out, CharmFunction& currentFunction) {
+	ONLYDEBUG puts("WE ARE DOING INLINE DEFINITIONS");
+	// only do inlining if the function says we can -- not just if it's possible
+	// many functions _aren't_ inlineable because they have type signatures, but
+	// they still have inlineDefinition's (in order to be able to use `inline`)
+	auto defInfo = definitionInfoCache.find(currentFunction.functionName);
+	if (defInfo != definitionInfoCache.end() && defInfo->second.inlineable) {
+		ONLYDEBUG printf("YES, %s IS INLINEABLE SO WE'RE ASKING THE COST MODEL\n", currentFunction.functionName.c_str());
+		return fA.inlineCall(out, currentFunction, inlineSite, false);
+	}
+	return false;
+}
+
 void Parser::delegateParsing(CHARM_LIST_TYPE& out, std::string& token, std::string& rest, bool willInline) {
 	ONLYDEBUG printf("DELEGATE PARSING %s\n", token.c_str());
 	CharmFunction currentFunction;
@@ -341,19 +406,11 @@ void Parser::delegateParsing(CHARM_LIST_TYPE& out, std::string& token, std::stri
 		currentFunction = Parser::parseDefinedFunction(token);
 		//if we're doing inline optimizations, do them here:
 		if (OPTIMIZE_INLINE && willInline) {
-			ONLYDEBUG puts("WE ARE DOING INLINE DEFINITIONS");
-            // only do inlining if the function says we can -- not just if it's possible
-            // many functions _aren't_ inlineable because they have type signatures, but
-            // they still have inlineDefinition's (in order to be able to use `inline`)
-            auto defInfo = definitionInfoCache.find(currentFunction.functionName);
-            if (defInfo != definitionInfoCache.end() && defInfo->second.inlineable) {
-                ONLYDEBUG printf("YES, %s IS INLINEABLE SO WE'RE DOING IT\n", currentFunction.functionName.c_str());
-    			if (fA.doInline(out, currentFunction)) {
-    				//if the function was able to be inline optimized, skip the final push_back
-    				//this means that we don't push a duplicate currentFunction
-    				return;
-    			}
-            }
+			if (Parser::tryInline(out, currentFunction)) {
+				//if the function was able to be inline optimized, skip the final push_back
+				//this means that we don't push a duplicate currentFunction
+				return;
+			}
 		}
 	} else if (type == NUMBER_FUNCTION) {
 		//next deal with NUMBER_FUNCTION
@@ -365,7 +422,7 @@ void Parser::delegateParsing(CHARM_LIST_TYPE& out, std::string& token, std::stri
 		//same thing as before, except it's a list
 		currentFunction = Parser::parseListFunction(token, rest);
 	}
-	out.push_back(currentFunction);
+	out.push_back(std::move(currentFunction));
 	if (DEBUGMODE) {
 		printf("AFTER 1 TOKEN, OUT NOW LOOKS LIKE THIS:\n     ");
 		for (CharmFunction f : out) {
@@ -404,7 +461,9 @@ std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> Parser::lexAskToInline(const std::
 			out.push_back(Parser::parseDefinition(line));
 		} else if (isLineTypeSignature(line)) {
             fA.addTypeSignature(Parser::parseTypeSignature(line));
-        } else {
+        } else if (isLineMemo(line)) {
+			Parser::parseMemo(line);
+		} else {
 			std::string rest = line;
 			std::string token;
 			while (Parser::advanceParse(token, rest)) {
@@ -417,9 +476,139 @@ std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> Parser::lexAskToInline(const std::
 		}
 	}
 	//wow, we're finally done with this abomination of a function
-	std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> outPair(out, &fA);
-	return outPair;
+	return std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*>(std::move(out), &fA);
 }
+FunctionAnalyzer* Parser::getFunctionAnalyzer() {
+	return &fA;
+}
+
 std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> Parser::lex(const std::string charmInput) {
-	return Parser::lexAskToInline(charmInput, true);
+	std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> out = Parser::lexAskToInline(charmInput, true);
+	fA.optimize(out.first);
+	return out;
+}
+
+void Parser::prelexLine(PrelexedLine& out) {
+	//only lines that can't possibly touch the analyzer get lexed ahead of time. anything with
+	//a second := or :: in it (even in a string or a list) gets lexed from scratch later, since
+	//those can define functions in the middle of the line
+	bool isDefinition = isLineFunctionDefinition(out.line);
+	bool isTypeSignature = !isDefinition && isLineTypeSignature(out.line);
+	auto firstDefinition = out.line.find(":=");
+	auto firstTypeSignature = out.line.find("::");
+	if (isDefinition) {
+		if (firstTypeSignature != std::string::npos || out.line.find(":=", firstDefinition + 2) != std::string::npos) {
+			return;
+		}
+	} else if (isTypeSignature) {
+		if (firstDefinition != std::string::npos) {
+			return;
+		}
+	} else if (firstDefinition != std::string::npos || firstTypeSignature != std::string::npos || isLineMemo(out.line)) {
+		return;
+	}
+	try {
+		if (isDefinition) {
+			std::string body;
+			out.definition = Parser::parseDefinitionName(out.line, body);
+			out.definition.literalFunctions = Parser::lexAskToInline(body, false).first;
+			out.kind = PrelexedLine::DEFINITION_LINE;
+		} else if (isTypeSignature) {
+			out.typeSignature = Parser::parseTypeSignature(out.line);
+			out.kind = PrelexedLine::TYPE_SIGNATURE_LINE;
+		} else {
+			out.code = Parser::lexAskToInline(out.line, false).first;
+			out.kind = PrelexedLine::CODE_LINE;
+		}
+	} catch (std::runtime_error& e) {
+		//leave it raw, the error gets reported in order once lexPrelexed gets to it
+		out.kind = PrelexedLine::RAW_LINE;
+	}
+}
+
+std::vector<PrelexedLine> Parser::prelex(const std::string& charmInput, const PrelexOptions& options) {
+	std::vector<PrelexedLine> out;
+	std::stringstream charmInputS(charmInput);
+	std::string line;
+	while (std::getline(charmInputS, line, '\n')) {
+		PrelexedLine prelexedLine;
+		prelexedLine.kind = PrelexedLine::RAW_LINE;
+		prelexedLine.line = line;
+		out.push_back(std::move(prelexedLine));
+	}
+	unsigned int threadCount = options.threadCount != 0 ? options.threadCount : std::thread::hardware_concurrency();
+	if (out.size() < options.threshold || threadCount < 2) {
+		//not worth it. every line stays raw and is lexed normally
+		return out;
+	}
+	//hand out chunks of lines to each thread. every thread has its own parser, and only
+	//writes to its own lines, so there's nothing to lock
+	const unsigned long CHUNK_SIZE = std::max(options.chunkSize, 1ul);
+	std::atomic<unsigned long> nextChunk(0);
+	auto worker = [&]() {
+		Parser chunkParser = Parser();
+		unsigned long chunk;
+		while ((chunk = nextChunk.fetch_add(1)) * CHUNK_SIZE < out.size()) {
+			unsigned long end = std::min(out.size(), (chunk + 1) * CHUNK_SIZE);
+			for (unsigned long n = chunk * CHUNK_SIZE; n < end; n++) {
+				chunkParser.prelexLine(out[n]);
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	try {
+		for (unsigned int n = 1; n < threadCount; n++) {
+			threads.emplace_back([&]() {
+				setQuietErrors(true);
+				worker();
+			});
+		}
+	} catch (std::system_error& e) {
+		//no threads available (ex: emscripten), whatever we've started plus this thread will do
+	}
+	//this thread pitches in too
+	bool wereErrorsQuiet = setQuietErrors(true);
+	worker();
+	setQuietErrors(wereErrorsQuiet);
+	for (std::thread& t : threads) {
+		t.join();
+	}
+	return out;
+}
+
+std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> Parser::lexPrelexed(PrelexedLine& line) {
+	CHARM_LIST_TYPE out;
+	switch (line.kind) {
+		case PrelexedLine::RAW_LINE:
+		return Parser::lex(line.line);
+
+		case PrelexedLine::TYPE_SIGNATURE_LINE:
+		fA.addTypeSignature(line.typeSignature);
+		break;
+
+		case PrelexedLine::DEFINITION_LINE: {
+			//this is the inlining that lex would have done while parsing the body
+			inlineSite = { line.definition.functionName, 0 };
+			CHARM_LIST_TYPE body;
+			for (CharmFunction& f : line.definition.literalFunctions) {
+				if (!(OPTIMIZE_INLINE && f.functionType == DEFINED_FUNCTION && Parser::tryInline(body, f))) {
+					body.push_back(std::move(f));
+				}
+			}
+			line.definition.literalFunctions = std::move(body);
+			Parser::finishDefinition(line.definition);
+			out.push_back(std::move(line.definition));
+			break;
+		}
+
+		case PrelexedLine::CODE_LINE:
+		for (CharmFunction& f : line.code) {
+			if (!(OPTIMIZE_INLINE && f.functionType == DEFINED_FUNCTION && Parser::tryInline(out, f))) {
+				out.push_back(std::move(f));
+			}
+		}
+		fA.optimize(out);
+		break;
+	}
+	return std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*>(std::move(out), &fA);
 }
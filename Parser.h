@@ -7,6 +7,36 @@
 #include "ParserTypes.h"
 #include "FunctionAnalyzer.h"
 
+//a line that was lexed ahead of time by Parser::prelex, but hasn't had any
+//inlining or analysis done to it yet (that happens in order, in Parser::lexPrelexed)
+struct PrelexedLine {
+	enum {
+		//couldn't (or wasn't worth it to) lex this ahead of time. lexPrelexed lexes it from scratch
+		RAW_LINE,
+		CODE_LINE,
+		DEFINITION_LINE,
+		TYPE_SIGNATURE_LINE
+	} kind;
+	std::string line;
+	CHARM_LIST_TYPE code;
+	CharmFunction definition;
+	CharmTypeSignature typeSignature;
+};
+
+//how Parser::prelex splits up the work. the defaults are whatever's fastest, the
+//lexer test changes them to put chunk boundaries everywhere
+struct PrelexOptions {
+	//files with fewer lines than this aren't worth starting threads for. it's enough for four
+	//chunks, so that every thread on a four core machine has something to do
+	unsigned long threshold = 512;
+	//0 is one per core
+	unsigned int threadCount = 0;
+	//how many lines a thread takes at a time. a line takes around 10us to lex, so a chunk is
+	//a lot more work than the ~10us it takes to start a thread, but still small enough that
+	//the threads finish at about the same time
+	unsigned long chunkSize = 128;
+};
+
 class Parser {
 private:
 	static inline void ltrim(std::string &s);
@@ -20,15 +50,24 @@ private:
 	bool isLineTypeSignature(std::string line);
 	CharmTypes tokenToType(std::string token);
 	CharmTypeSignature parseTypeSignature(std::string line);
-	CharmFunctionDefinitionInfo analyzeDefinition(CharmFunction f);
+	//`memo <name>` or `memo <name> <size>`
+	bool isLineMemo(std::string line);
+	void parseMemo(std::string line);
+	CharmFunctionDefinitionInfo analyzeDefinition(const CharmFunction& f);
 
 	FunctionAnalyzer fA;
 	std::unordered_map<std::string, CharmFunctionDefinitionInfo> definitionInfoCache;
+	//the definition whose body is being lexed right now, for the inliner
+	FunctionAnalyzer::InlineSite inlineSite;
 
 	bool advanceParse(std::string& token, std::string& rest);
 	void delegateParsing(CHARM_LIST_TYPE& out, std::string& token, std::string& rest, bool willInline);
 
 	CharmFunction parseDefinition(std::string line);
+	CharmFunction parseDefinitionName(std::string line, std::string& body);
+	void finishDefinition(CharmFunction& f);
+	bool tryInline(CHARM_LIST_TYPE& out, CharmFunction& currentFunction);
+	void prelexLine(PrelexedLine& out);
 	CharmFunction parseDefinedFunction(std::string tok);
 	CharmFunction parseNumberFunction(std::string tok);
 	std::string escapeString(std::string tok);
@@ -38,4 +77,11 @@ public:
 	Parser();
 	std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> lex(const std::string charmInput);
 	std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> lexAskToInline(const std::string charmInput, bool willInline);
+	FunctionAnalyzer* getFunctionAnalyzer();
+
+	//files are lexed in two steps. prelex splits the input into lines and, if there are enough
+	//of them, lexes them on a pool of threads. then each line is finished with lexPrelexed, in
+	//order, right before it runs. this gives exactly the same result as calling lex on each line
+	std::vector<PrelexedLine> prelex(const std::string& charmInput, const PrelexOptions& options = PrelexOptions());
+	std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> lexPrelexed(PrelexedLine& line);
 };
@@ -4,6 +4,7 @@
 #include <vector>
 #include <deque>
 #include <variant>
+#include <memory>
 #include <gmpxx.h>
 
 #ifndef CHARM_STACK_TYPE
@@ -57,6 +58,34 @@ struct CharmNumber {
 	mpf_class floatValue;
 	//to allow Charm to support both floats
 	//and integers, we add both
+
+	CharmNumber() = default;
+	CharmNumber(const CharmNumber& other) = default;
+	CharmNumber& operator=(const CharmNumber& other) = default;
+	//mpf_class doesn't say its move can't throw, so vectors of CharmFunctions would copy every
+	//number whenever they grow. gmp aborts instead of throwing when it's out of memory, so it can't
+	CharmNumber(CharmNumber&& other) noexcept
+		: whichType(other.whichType), integerValue(std::move(other.integerValue)), floatValue(std::move(other.floatValue)) {}
+	CharmNumber& operator=(CharmNumber&& other) noexcept {
+		whichType = other.whichType;
+		integerValue = std::move(other.integerValue);
+		floatValue = std::move(other.floatValue);
+		return *this;
+	}
+};
+
+//in FunctionAnalyzer.h
+class FunctionAnalyzer;
+struct CharmFunction;
+
+//the optimized code of a list, built by FunctionAnalyzer::compileQuotation the first time
+//the list is run with `i`. every copy of a list shares one of these, so anything that
+//changes a list's literalFunctions has to give it a new one
+struct CompiledQuotation {
+	std::shared_ptr<const CHARM_LIST_TYPE> code;
+	//the analyzer that built `code`, and its generation at the time
+	const FunctionAnalyzer* analyzer = nullptr;
+	unsigned long long generation = 0;
 };
 
 struct CharmFunctionDefinitionInfo {
@@ -71,10 +100,16 @@ struct CharmFunction {
 	CharmNumber numberValue;
 	//ONLY USED WITH LIST_FUNCTION AND FUNCTION_DEFINITION
 	CHARM_LIST_TYPE literalFunctions;
+	//ONLY USED WITH LIST_FUNCTION
+	//nullptr for lists that builtins like `q` and `split` make, those are run without being cached
+	std::shared_ptr<CompiledQuotation> compiled;
 	//ONLY USED WITH DEFINED_FUNCTION AND FUNCTION_DEFINITION
 	std::string functionName;
 	//ONLY USED WITH FUNCTION_DEFINITION
 	CharmFunctionDefinitionInfo definitionInfo;
+	//ONLY USED WITH DEFINED_FUNCTION
+	//false if FunctionAnalyzer proved that the type signature always holds at this call
+	bool typeChecked = true;
 };
 inline std::string charmTypeToString(CharmTypes t) {
 	switch (t) {
@@ -253,5 +288,4 @@ struct CharmDefinition {
 };
 
 class FunctionDefinition;
-class FunctionAnalyzer;
 
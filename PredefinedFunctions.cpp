@@ -4,8 +4,11 @@
 #include <iostream>
 #include <variant>
 #include <unordered_map>
+#include <map>
 #include <functional>
 #include <utility>
+#include <chrono>
+#include <algorithm>
 
 #include "PredefinedFunctions.h"
 #include "ParserTypes.h"
@@ -14,7 +17,7 @@
 #include "Runner.h"
 #include "FunctionAnalyzer.h"
 #include "FFI.h"
-#include "Parser.h"
+#include "ModuleCache.h"
 
 #ifdef CHARM_GUI
 #include "gui.h"
@@ -30,6 +33,49 @@ static std::string get_input_line() {
 }
 #endif
 
+//which branch an `ifthen` condition takes: a positive int is truthy, and any other int is
+//falsy. a condition that isn't an int is an error, wherever the ifthen is run from
+static bool isTruthy(const CharmFunction& cond) {
+	if (!Stack::isInt(cond)) {
+		runtime_die("`ifthen` condition returned non integer.");
+	}
+	return sgn(cond.numberValue.integerValue) == 1;
+}
+
+//superinstructions are made by FunctionAnalyzer::optimize. the first operand is always the
+//code that was replaced, and the rest are the literals that the pattern captured
+static const CHARM_LIST_TYPE& superinstructionOperands(RunnerContext& context, std::string name, unsigned long count) {
+	if (context.instruction == nullptr || context.instruction->literalFunctions.size() != count + 1) {
+		runtime_die("`" + name + "` is made by the optimizer and can't be called directly.");
+	}
+	return context.instruction->literalFunctions;
+}
+
+//run the code that a superinstruction replaced. this is the slow path, for whenever
+//the fast path can't promise to do exactly the same thing
+static void runUnfused(Runner* r, RunnerContext& context) {
+	r->runWithContext(context.instruction->literalFunctions[0].literalFunctions, context);
+}
+
+//`n copyfrom` without going through the definition. only safe if isCopyfromInRange,
+//otherwise one of the swaps in the definition would have errored
+static bool isCopyfromInRange(Runner* r, const CharmFunction& n) {
+	return sgn(n.numberValue.integerValue) >= 0 && n.numberValue.integerValue + 1 < r->MAX_STACK;
+}
+static void copyfromFast(Runner* r, const CharmFunction& n) {
+	CharmFunction copyfromRef;
+	copyfromRef.functionType = STRING_FUNCTION;
+	copyfromRef.stringValue = "copyfromref";
+	r->setReference(copyfromRef, n);
+	unsigned long long index = n.numberValue.integerValue.get_ui();
+	Stack* s = r->getCurrentStack();
+	s->swap(index, 0);
+	CharmFunction f1 = s->pop();
+	s->push(f1);
+	s->push(f1);
+	s->swap(index + 1, 1);
+}
+
 void PredefinedFunctions::addBuiltinFunction(std::string n, std::function<void(Runner*)> f) {
 	BuiltinFunction bf;
 	bf.f = f; bf.takesContext = false;
@@ -41,13 +87,12 @@ void PredefinedFunctions::addBuiltinFunction(std::string n, std::function<void(R
 	cppFunctionNames[n] = bf;
 }
 void PredefinedFunctions::functionLookup(std::string functionName, Runner* r, RunnerContext& context) {
-	auto f = cppFunctionNames.at(functionName);
+	BuiltinFunction& f = cppFunctionNames.at(functionName);
+	f.calls++;
 	if (f.takesContext) {
-		auto castF = std::get<std::function<void(Runner*, RunnerContext)>>(f.f);
-		castF(r, context);
+		std::get<std::function<void(Runner*, RunnerContext)>>(f.f)(r, context);
 	} else {
-		auto castF = std::get<std::function<void(Runner*)>>(f.f);
-		castF(r);
+		std::get<std::function<void(Runner*)>>(f.f)(r);
 	}
 }
 
@@ -78,6 +123,43 @@ PredefinedFunctions::PredefinedFunctions() {
 	/*************************************
 	DEBUGGING FUNCTIONS
 	*************************************/
+	addBuiltinFunction("memostats", [](Runner* r) {
+		//sorted by name, so the output doesn't depend on the hash table
+		std::map<std::string, const MemoCache*> memos;
+		for (auto& fD : r->functionDefinitions) {
+			if (fD.second.memo) {
+				memos[fD.first] = fD.second.memo.get();
+			}
+		}
+		if (memos.empty()) {
+			display_output("no functions are memoized\n");
+		}
+		for (auto& memo : memos) {
+			display_output(memo.first + ": " +
+				std::to_string(memo.second->hits) + (memo.second->hits == 1 ? " hit, " : " hits, ") +
+				std::to_string(memo.second->misses) + (memo.second->misses == 1 ? " miss, " : " misses, ") +
+				std::to_string(memo.second->entries.size()) + " cached (at most " + std::to_string(memo.second->capacity) + ")\n");
+		}
+	});
+	addBuiltinFunction("stats", [](Runner* r) {
+		//a list of [ " what it counts " count ] pairs
+		CharmFunction out;
+		out.functionType = LIST_FUNCTION;
+		for (auto& stat : r->getStats()) {
+			CharmFunction name;
+			name.functionType = STRING_FUNCTION;
+			name.stringValue = stat.first;
+			CharmFunction count;
+			count.functionType = NUMBER_FUNCTION;
+			count.numberValue.whichType = INTEGER_VALUE;
+			count.numberValue.integerValue = (unsigned long)stat.second;
+			CharmFunction pair;
+			pair.functionType = LIST_FUNCTION;
+			pair.literalFunctions = { name, count };
+			out.literalFunctions.push_back(pair);
+		}
+		r->getCurrentStack()->push(out);
+	});
 	addBuiltinFunction("type", [](Runner* r) {
 		CharmFunction f1 = r->getCurrentStack()->pop();
 		CharmFunction out;
@@ -124,23 +206,34 @@ PredefinedFunctions::PredefinedFunctions() {
 		CharmFunction f;
 		f.functionType = FUNCTION_DEFINITION;
 		f.functionName = f2.stringValue;
-		f.literalFunctions = f1.literalFunctions;
-
-		FunctionDefinition fD;
-		fD.functionName = f.functionName;
-		fD.functionBody = f.literalFunctions;
+		//the body gets inlined into just like the parser would for a := definition
+		FunctionAnalyzer::InlineSite site = { f.functionName, 0 };
+		for (const CharmFunction& bodyFunction : f1.literalFunctions) {
+			if (!(OPTIMIZE_INLINE && bodyFunction.functionType == DEFINED_FUNCTION && context.fA->inlineCall(f.literalFunctions, bodyFunction, site, false))) {
+				f.literalFunctions.push_back(bodyFunction);
+			}
+		}
+		context.fA->countDefinition(f.functionName);
+		context.fA->addDefinitionBody(f.functionName, f.literalFunctions);
+		context.fA->checkMemo(f.functionName);
 
 		CharmFunctionDefinitionInfo defInfo;
 		defInfo.inlineable = context.fA->isInlinable(f);
-		if (defInfo.inlineable) {
-			context.fA->addToInlineDefinitions(f);
+		if (context.fA->isInlinableIgnoringTypeSignature(f)) {
+			context.fA->addToInlineDefinitions(f, site.depth);
 		}
-		defInfo.tailCallRecursive = context.fA->isInlinable(f);
+		defInfo.tailCallRecursive = context.fA->isTailCallRecursive(f);
+
+		FunctionDefinition fD;
+		fD.functionName = f.functionName;
+		fD.functionBody = f.literalFunctions;
+		context.fA->optimize(fD.functionBody, f.functionName);
 
 		fD.definitionInfo = defInfo;
+		fD.memo = Runner::memoCacheFor(fD.functionName, context.fA);
 		r->addFunctionDefinition(fD);
 	});
-	addBuiltinFunction("ffi", [](Runner* r) {
+	addBuiltinFunction("ffi", [](Runner* r, RunnerContext context) {
 		//library symbol
 		CharmFunction f1 = r->getCurrentStack()->pop();
 		//library path
@@ -151,6 +244,8 @@ PredefinedFunctions::PredefinedFunctions() {
 			runtime_die("Non string passed to `ffi`.");
 		}
 		r->ffi->loadMutateFFI(f3.stringValue, f2.stringValue, f1.stringValue);
+		//ffi functions run before definitions, so lists that inlined one with this name are wrong now
+		context.fA->invalidateCompiledQuotations();
 	});
 	/*************************************
 	COMPARISONS
@@ -265,6 +360,8 @@ PredefinedFunctions::PredefinedFunctions() {
 					f2.literalFunctions.begin(),
 					f2.literalFunctions.end()
 				);
+				//every copy of the old list shares its compiled code, this one needs its own now
+				f3.compiled = std::make_shared<CompiledQuotation>();
 			} else {
 				runtime_die("Attempted to `insert` a non list into a list.");
 			}
@@ -290,6 +387,7 @@ PredefinedFunctions::PredefinedFunctions() {
 		//make sure they're both lists or strings
 		if ((f1.functionType == LIST_FUNCTION) && (f2.functionType == LIST_FUNCTION)) {
 			f2.literalFunctions.insert(f2.literalFunctions.end(), f1.literalFunctions.begin(), f1.literalFunctions.end());
+			f2.compiled = std::make_shared<CompiledQuotation>();
 		} else if ((f1.functionType == STRING_FUNCTION) && (f2.functionType == STRING_FUNCTION)) {
 			f2.stringValue = f2.stringValue + f1.stringValue;
 		} else {
@@ -383,11 +481,72 @@ PredefinedFunctions::PredefinedFunctions() {
 		CharmFunction f1 = r->getCurrentStack()->pop();
 		if (f1.functionType == LIST_FUNCTION) {
 			//when we run with `i`, remove the context (we can't tail call from an `i`)
-			r->run(std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*>(f1.literalFunctions, context.fA));
+			RunnerContext topLevel = Runner::topLevelContext(context.fA);
+			//the list's compiled code is kept alive here, in case running it recompiles the list
+			std::shared_ptr<const CHARM_LIST_TYPE> code = context.fA->compileQuotation(f1);
+			r->runWithContext(code ? *code : f1.literalFunctions, topLevel);
 		} else {
 			runtime_die("Non list passed to `i`.");
 		}
 	});
+	addBuiltinFunction("bench", [](Runner* r, RunnerContext context) {
+		//how many times to time it
+		CharmFunction f1 = r->getCurrentStack()->pop();
+		//the list to time
+		CharmFunction f2 = r->getCurrentStack()->pop();
+		if (!Stack::isInt(f1) || f1.numberValue.integerValue < 1 || !f1.numberValue.integerValue.fits_ulong_p()) {
+			runtime_die("Non positive iteration count passed to `bench`.");
+		}
+		if (f2.functionType != LIST_FUNCTION) {
+			runtime_die("Non list passed to `bench`.");
+		}
+		unsigned long iterations = f1.numberValue.integerValue.get_ui();
+		//a tenth as many runs first, that aren't timed
+		unsigned long warmup = iterations / 10 + 1;
+		//run like `i` would, compiled once up front
+		RunnerContext topLevel = Runner::topLevelContext(context.fA);
+		std::shared_ptr<const CHARM_LIST_TYPE> code = context.fA->compileQuotation(f2);
+		const CHARM_LIST_TYPE& body = code ? *code : f2.literalFunctions;
+		//every run starts from the same stack, whatever the run before it did to it
+		CharmFunction stackName = r->getCurrentStack()->name;
+		CHARM_STACK_TYPE saved = r->getCurrentStack()->stack;
+		std::vector<unsigned long long> times;
+		for (unsigned long n = 0; n < warmup + iterations; n++) {
+			auto start = std::chrono::steady_clock::now();
+			r->runWithContext(body, topLevel);
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			if (n >= warmup) {
+				times.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+			}
+			if (!r->getCurrentStack()->isNameEqualTo(stackName)) {
+				r->switchCurrentStack(stackName);
+			}
+			r->getCurrentStack()->stack = saved;
+			r->getCurrentStack()->updatePeakDepth();
+		}
+		std::sort(times.begin(), times.end());
+		unsigned long long median = times.size() % 2 == 1 ? times[times.size() / 2] : (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+		//[ min median max ], in nanoseconds
+		CharmFunction out;
+		out.functionType = LIST_FUNCTION;
+		for (unsigned long long ns : { times.front(), median, times.back() }) {
+			CharmFunction time;
+			time.functionType = NUMBER_FUNCTION;
+			time.numberValue.whichType = INTEGER_VALUE;
+			time.numberValue.integerValue = (unsigned long)ns;
+			out.literalFunctions.push_back(time);
+		}
+		r->getCurrentStack()->push(out);
+	});
+	addBuiltinFunction("clock", [](Runner* r) {
+		//nanoseconds from a clock that only ever goes forward. only the difference between
+		//two of these means anything
+		CharmFunction out;
+		out.functionType = NUMBER_FUNCTION;
+		out.numberValue.whichType = INTEGER_VALUE;
+		out.numberValue.integerValue = (unsigned long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		r->getCurrentStack()->push(out);
+	});
 	addBuiltinFunction("q", [](Runner* r) {
 		CharmFunction f1 = r->getCurrentStack()->pop();
 		CharmFunction list;
@@ -416,7 +575,8 @@ PredefinedFunctions::PredefinedFunctions() {
 				//first, we run checks to set the tail call bools
 				//we can only do TCO if we're in a function definition -- that is, context's fD (functionDefinition) is non-null
 				//we can also only do TCO if the if we are the last thing that happens
-				if (context.inDefinition && context.fIndex == context.fD.functionBody.size() - 1) {
+				//(and the ifthen is in the definition's own body, not in some list that was run from it)
+				if (context.inDefinition && context.fIndex == context.fD->functionBody.size() - 1 && context.instruction == &context.fD->functionBody.back()) {
 					/*
 					bool truthyTailCall =
 						std::find_if(
@@ -432,12 +592,12 @@ PredefinedFunctions::PredefinedFunctions() {
 					bool truthyTailCall;
 					bool falsyTailCall;
 					if (truthy.literalFunctions.size() > 0) {
-						truthyTailCall = std::prev(truthy.literalFunctions.end())->functionName == context.fD.functionName;
+						truthyTailCall = std::prev(truthy.literalFunctions.end())->functionName == context.fD->functionName;
 					} else {
 						truthyTailCall = false;
 					}
 					if (falsy.literalFunctions.size() > 0) {
-						falsyTailCall = std::prev(falsy.literalFunctions.end())->functionName == context.fD.functionName;
+						falsyTailCall = std::prev(falsy.literalFunctions.end())->functionName == context.fD->functionName;
 					} else {
 						falsyTailCall = false;
 					}
@@ -453,74 +613,75 @@ PredefinedFunctions::PredefinedFunctions() {
 					r->runWithContext(condFunction.literalFunctions, context);
 					//now we check the top of the stack to see if it's truthy or falsy
 					CharmFunction cond = r->getCurrentStack()->pop();
-					if (Stack::isInt(cond)) {
-						if (sgn(cond.numberValue.integerValue) == 1) {
-							if (truthyTailCall) {
-								ONLYDEBUG puts("PERFORMING TRUTHY TAIL CALL RECURSION");
-								//if we do tail call, pop the tailcall and the ifthen (guarenteed to be at the end),
-								truthy.literalFunctions.pop_back();
-								ONLYDEBUG printf("context->fD->functionName is %s\n", context.fD.functionName.c_str());
-								CHARM_LIST_TYPE tcoFunctionBody = context.fD.functionBody;
-								tcoFunctionBody.pop_back();
-								ONLYDEBUG printf("AFTER TRUTHY TAIL CALL IF/THEN PRUNING, tcoFunctionBody IS:\n    ");
-								for (auto currentFunction : tcoFunctionBody) {
-									ONLYDEBUG printf("%s ", charmFunctionToString(currentFunction).c_str());
-								}
-								ONLYDEBUG puts("");
-								//then run the new stripped definitions in a loop
-								while (1) {
-									r->runWithContext(truthy.literalFunctions, context);
-									//remember: the ifthen is guarenteed to be at the end for a tail call, so run the entire body
-									r->runWithContext(tcoFunctionBody, context);
-									//now, we'll have 3 things at the top of the stack: the cond, truthy, and falsy. we _don't_ need these, as we already have copies. remove them.
-									r->getCurrentStack()->pop(); //falsy
-									r->getCurrentStack()->pop(); //truthy
-									r->getCurrentStack()->pop(); //condFunction
-									//now, we run our preset condFunction for the falsy check
-									r->runWithContext(condFunction.literalFunctions, context);
-									//we do another little branch in the tail call, but we just mostly check for falsyness
-									if (sgn(r->getCurrentStack()->pop().numberValue.integerValue) < 1) {
-										r->runWithContext(falsy.literalFunctions, context);
-										return;
-									}
-								}
-							} else {
-								//if there was no truthy tail call, just run as normal
-								r->runWithContext(truthy.literalFunctions, context);
+					if (isTruthy(cond)) {
+						r->stats.truthyBranches++;
+						if (truthyTailCall) {
+							ONLYDEBUG puts("PERFORMING TRUTHY TAIL CALL RECURSION");
+							//if we do tail call, pop the tailcall and the ifthen (guarenteed to be at the end),
+							truthy.literalFunctions.pop_back();
+							ONLYDEBUG printf("context->fD->functionName is %s\n", context.fD->functionName.c_str());
+							CHARM_LIST_TYPE tcoFunctionBody = context.fD->functionBody;
+							tcoFunctionBody.pop_back();
+							ONLYDEBUG printf("AFTER TRUTHY TAIL CALL IF/THEN PRUNING, tcoFunctionBody IS:\n    ");
+							for (auto currentFunction : tcoFunctionBody) {
+								ONLYDEBUG printf("%s ", charmFunctionToString(currentFunction).c_str());
 							}
-						} else {
-							if (falsyTailCall) {
-								ONLYDEBUG puts("PERFORMING FALSY TAIL CALL RECURSION");
-								//if we do tail call, pop the tailcall and the ifthen (guarenteed to be at the end),
-								falsy.literalFunctions.pop_back();
-								auto tcoFunctionBody = context.fD.functionBody;
-								tcoFunctionBody.pop_back();
-								//then run the new stripped definitions in a loop
-								while (1) {
+							ONLYDEBUG puts("");
+							//then run the new stripped definitions in a loop
+							while (1) {
+								r->tailCallIteration();
+								r->runWithContext(truthy.literalFunctions, context);
+								//remember: the ifthen is guarenteed to be at the end for a tail call, so run the entire body
+								r->runWithContext(tcoFunctionBody, context);
+								//now, we'll have 3 things at the top of the stack: the cond, truthy, and falsy. we _don't_ need these, as we already have copies. remove them.
+								r->getCurrentStack()->pop(); //falsy
+								r->getCurrentStack()->pop(); //truthy
+								r->getCurrentStack()->pop(); //condFunction
+								//now, we run our preset condFunction for the falsy check
+								r->runWithContext(condFunction.literalFunctions, context);
+								//we do another little branch in the tail call, but we just mostly check for falsyness
+								if (!isTruthy(r->getCurrentStack()->pop())) {
+									r->stats.falsyBranches++;
 									r->runWithContext(falsy.literalFunctions, context);
-									//remember: the ifthen is guarenteed to be at the end for a tail call, so run the entire body
-									r->runWithContext(tcoFunctionBody, context);
-									//now, we'll have 3 things at the top of the stack: the cond, truthy, and falsy. we _don't_ need these, as we already have copies. remove them.
-									r->getCurrentStack()->pop(); //falsy
-									r->getCurrentStack()->pop(); //truthy
-									r->getCurrentStack()->pop(); //condFunction
-									//now, we run our preset condFunction for the falsy check
-									r->runWithContext(condFunction.literalFunctions, context);
-									//we do another little branch in the tail call, but we just mostly check for truthyness
-									if (sgn(r->getCurrentStack()->pop().numberValue.integerValue) == 1) {
-										r->runWithContext(truthy.literalFunctions, context);
-										return;
-									}
+									return;
 								}
-							} else {
-								//if the falsy block doesn't tail call, just run it normally
-								r->runWithContext(falsy.literalFunctions, context);
+								r->stats.truthyBranches++;
 							}
+						} else {
+							//if there was no truthy tail call, just run as normal
+							r->runWithContext(truthy.literalFunctions, context);
 						}
 					} else {
-						runtime_die("`ifthen` condition returned non integer.");
-						if (context.inDefinition) {
-							printf("This occured in the definition of %s\n", context.fD.functionName.c_str());
+						r->stats.falsyBranches++;
+						if (falsyTailCall) {
+							ONLYDEBUG puts("PERFORMING FALSY TAIL CALL RECURSION");
+							//if we do tail call, pop the tailcall and the ifthen (guarenteed to be at the end),
+							falsy.literalFunctions.pop_back();
+							auto tcoFunctionBody = context.fD->functionBody;
+							tcoFunctionBody.pop_back();
+							//then run the new stripped definitions in a loop
+							while (1) {
+								r->tailCallIteration();
+								r->runWithContext(falsy.literalFunctions, context);
+								//remember: the ifthen is guarenteed to be at the end for a tail call, so run the entire body
+								r->runWithContext(tcoFunctionBody, context);
+								//now, we'll have 3 things at the top of the stack: the cond, truthy, and falsy. we _don't_ need these, as we already have copies. remove them.
+								r->getCurrentStack()->pop(); //falsy
+								r->getCurrentStack()->pop(); //truthy
+								r->getCurrentStack()->pop(); //condFunction
+								//now, we run our preset condFunction for the falsy check
+								r->runWithContext(condFunction.literalFunctions, context);
+								//we do another little branch in the tail call, but we just mostly check for truthyness
+								if (isTruthy(r->getCurrentStack()->pop())) {
+									r->stats.truthyBranches++;
+									r->runWithContext(truthy.literalFunctions, context);
+									return;
+								}
+								r->stats.falsyBranches++;
+							}
+						} else {
+							//if the falsy block doesn't tail call, just run it normally
+							r->runWithContext(falsy.literalFunctions, context);
 						}
 					}
 				}
@@ -530,14 +691,12 @@ PredefinedFunctions::PredefinedFunctions() {
 				r->runWithContext(condFunction.literalFunctions, context);
 				//now we check the top of the stack to see if it's truthy or falsy
 				CharmFunction cond = r->getCurrentStack()->pop();
-				if (Stack::isInt(cond)) {
-					if (sgn(cond.numberValue.integerValue) == 1) {
-						r->runWithContext(truthy.literalFunctions, context);
-					} else {
-						r->runWithContext(falsy.literalFunctions, context);
-					}
+				if (isTruthy(cond)) {
+					r->stats.truthyBranches++;
+					r->runWithContext(truthy.literalFunctions, context);
 				} else {
-					runtime_die("`ifthen` condition returned non integer.");
+					r->stats.falsyBranches++;
+					r->runWithContext(falsy.literalFunctions, context);
 				}
 			} else {
 				runtime_die("Non list passed to `ifthen`.");
@@ -626,10 +785,15 @@ PredefinedFunctions::PredefinedFunctions() {
 		CharmFunction f1 = r->getCurrentStack()->pop();
 		CharmFunction f2 = r->getCurrentStack()->pop();
 		if (Stack::isInt(f1) && Stack::isInt(f2)) {
+			//gmp doesn't throw on division by zero, it crashes
+			if (sgn(f1.numberValue.integerValue) == 0) {
+				runtime_die("Division by zero in `/`.");
+			}
+			mpz_class divisor = f1.numberValue.integerValue;
 			//f1 used as answer
-			f1.numberValue.integerValue = f2.numberValue.integerValue / f1.numberValue.integerValue;
+			f1.numberValue.integerValue = f2.numberValue.integerValue / divisor;
 			//f2 used as modulus
-			f2.numberValue.integerValue = f2.numberValue.integerValue % f1.numberValue.integerValue;
+			f2.numberValue.integerValue = f2.numberValue.integerValue % divisor;
 		} else {
 			runtime_die("Non integer passed to `/`.");
 		}
@@ -688,12 +852,127 @@ PredefinedFunctions::PredefinedFunctions() {
 		r->setReference(f2, f1);
 	});
 	/*************************************
+	SUPERINSTRUCTIONS
+	*************************************/
+	//these are never written by hand, FunctionAnalyzer::optimize puts them in place of the
+	//code in their names. each one has to do exactly what that code would have done,
+	//errors included (usually by falling back to running that code)
+	addBuiltinFunction("%flip", [](Runner* r) {
+		r->getCurrentStack()->swap(1, 0);
+	});
+	addBuiltinFunction("%succ", [](Runner* r, RunnerContext context) {
+		superinstructionOperands(context, "%succ", 0);
+		Stack* s = r->getCurrentStack();
+		if (s->stack.size() > 0 && Stack::isInt(s->stack.back())) {
+			s->stack.back().numberValue.integerValue += 1;
+		} else {
+			runUnfused(r, context);
+		}
+	});
+	addBuiltinFunction("%not", [](Runner* r, RunnerContext context) {
+		superinstructionOperands(context, "%not", 0);
+		Stack* s = r->getCurrentStack();
+		if (s->stack.size() > 0 && Stack::isInt(s->stack.back())) {
+			mpz_class& value = s->stack.back().numberValue.integerValue;
+			value = (sgn(value) == 1) ? 0 : 1;
+		} else {
+			runUnfused(r, context);
+		}
+	});
+	addBuiltinFunction("%permute", [](Runner* r, RunnerContext context) {
+		//operands are how many values to take off of the stack, and which of them
+		//to push back (bottom first, 0 being the old top)
+		const CHARM_LIST_TYPE& operands = superinstructionOperands(context, "%permute", 2);
+		Stack* s = r->getCurrentStack();
+		unsigned long takenCount = operands[1].numberValue.integerValue.get_ui();
+		std::vector<CharmFunction> taken;
+		taken.reserve(takenCount);
+		for (unsigned long n = 0; n < takenCount; n++) {
+			taken.push_back(s->pop());
+		}
+		for (const CharmFunction& index : operands[2].literalFunctions) {
+			s->push(taken[index.numberValue.integerValue.get_ui()]);
+		}
+	});
+	addBuiltinFunction("%getref", [](Runner* r, RunnerContext context) {
+		const CHARM_LIST_TYPE& operands = superinstructionOperands(context, "%getref", 1);
+		r->getCurrentStack()->push(r->getReference(operands[1]));
+	});
+	addBuiltinFunction("%setref", [](Runner* r, RunnerContext context) {
+		const CHARM_LIST_TYPE& operands = superinstructionOperands(context, "%setref", 1);
+		r->setReference(operands[1], r->getCurrentStack()->pop());
+	});
+	addBuiltinFunction("%copyfrom", [](Runner* r, RunnerContext context) {
+		const CHARM_LIST_TYPE& operands = superinstructionOperands(context, "%copyfrom", 1);
+		if (isCopyfromInRange(r, operands[1])) {
+			copyfromFast(r, operands[1]);
+		} else {
+			runUnfused(r, context);
+		}
+	});
+	addBuiltinFunction("%dupcopyfrom+", [](Runner* r, RunnerContext context) {
+		const CHARM_LIST_TYPE& operands = superinstructionOperands(context, "%dupcopyfrom+", 1);
+		if (!isCopyfromInRange(r, operands[1])) {
+			runUnfused(r, context);
+			return;
+		}
+		Stack* s = r->getCurrentStack();
+		CharmFunction top = s->pop();
+		s->push(top);
+		s->push(top);
+		copyfromFast(r, operands[1]);
+		CharmFunction f1 = s->pop();
+		CharmFunction f2 = s->pop();
+		if (Stack::isInt(f1) && Stack::isInt(f2)) {
+			f1.numberValue.integerValue = f1.numberValue.integerValue + f2.numberValue.integerValue;
+		} else {
+			runtime_die("Non integer passed to `+`.");
+		}
+		s->push(f1);
+	});
+	addBuiltinFunction("%ifthen", [](Runner* r, RunnerContext context) {
+		//`[ cond ] [ truthy ] [ falsy ] ifthen` with the three lists as operands, so they're run
+		//right where they are instead of being pushed, popped and copied
+		const CHARM_LIST_TYPE& operands = superinstructionOperands(context, "%ifthen", 3);
+		const CHARM_LIST_TYPE& condition = operands[1].literalFunctions;
+		const CHARM_LIST_TYPE& truthy = operands[2].literalFunctions;
+		const CHARM_LIST_TYPE& falsy = operands[3].literalFunctions;
+		//the same tail call optimization as ifthen: if this is the last thing in a definition's
+		//body, and the branch that's taken ends by calling that definition, then run the branch
+		//and the rest of the body in a loop instead of recursing
+		bool isLast = context.inDefinition && context.instruction == &context.fD->functionBody.back();
+		bool truthyTailCall = isLast && truthy.size() > 0 && truthy.back().functionName == context.fD->functionName;
+		bool falsyTailCall = isLast && falsy.size() > 0 && falsy.back().functionName == context.fD->functionName;
+		if (truthyTailCall && falsyTailCall) {
+			runtime_die("Both branches of `ifthen` make a tail call. This is unsupported. Please refactor to move the tail call to the outside.");
+		}
+		CHARM_LIST_TYPE tailCallBranch, tailCallBody;
+		if (truthyTailCall || falsyTailCall) {
+			const CHARM_LIST_TYPE& branch = truthyTailCall ? truthy : falsy;
+			tailCallBranch.assign(branch.begin(), std::prev(branch.end()));
+			tailCallBody.assign(context.fD->functionBody.begin(), std::prev(context.fD->functionBody.end()));
+		}
+		while (1) {
+			r->runWithContext(condition, context);
+			bool truthyBranch = isTruthy(r->getCurrentStack()->pop());
+			(truthyBranch ? r->stats.truthyBranches : r->stats.falsyBranches)++;
+			if (truthyBranch ? !truthyTailCall : !falsyTailCall) {
+				r->runWithContext(truthyBranch ? truthy : falsy, context);
+				return;
+			}
+			r->tailCallIteration();
+			r->runWithContext(tailCallBranch, context);
+			r->runWithContext(tailCallBody, context);
+		}
+	});
+	/*************************************
 	LIBRARY INTERACTION
 	*************************************/
 	addBuiltinFunction("include", [](Runner* r) {
-		//NOTE: no inlining is done for included files
-		//this is because all inlining is done at compile time,
-		//and this inclusion happens at runtime
+		//NOTE: included files are lexed (and inlined) with their own parser,
+		//so they can't inline anything from the file that included them.
+		//the lexed and namespaced result is cached in memory and on disk (see
+		//ModuleCache.cpp), so including an unchanged file again costs a hash check
 
 		//the namespace to place functions in
 		CharmFunction f1 = r->getCurrentStack()->pop();
@@ -702,11 +981,6 @@ PredefinedFunctions::PredefinedFunctions() {
 		if ((f1.functionType != STRING_FUNCTION) || (f2.functionType != STRING_FUNCTION)) {
 			runtime_die("Non string passed to `include`.");
 		}
-		std::string line;
-		std::ifstream importFile(f2.stringValue);
-		Parser parser = Parser();
-		while (std::getline(importFile, line)) {
-			r->run(parser.lex(line), f1.stringValue);
-		}
+		r->moduleCache->include(f2.stringValue, f1.stringValue, r);
 	});
 }
@@ -16,6 +16,8 @@ class RunnerContext;
 struct BuiltinFunction {
 	std::variant<std::function<void(Runner*)>, std::function<void(Runner*, RunnerContext)>> f;
 	bool takesContext;
+	//how many times it's been run, for `stats`
+	unsigned long long calls = 0;
 };
 
 class PredefinedFunctions {
@@ -125,7 +125,7 @@ _cut          := [ _cut_distance succ ] [ _cut_iter _cut ] [ pop pop flip ] ifth
 cut           := _cut_args _cut
 
 " [ list ] <number> repeat " pop
-repeat :: list/string int -> list
+repeat :: list int -> list | string int -> string
 _repeat_args := flip type " repeattyperef " flip setref dup 0 2 swap 1 -
 _repeat_iter := 0 2 swap dup 0 2 swap concat flip 2 0 swap 1 -
 _repeat_zero := [ " repeattyperef " getref " LIST_FUNCTION " eq ] [ [ ] ] [ " " ] ifthen
@@ -150,7 +150,7 @@ delitem :: list int -> list
 delitem := 1 + split flip len 1 - split pop flip concat
 
 fromcharlist :: list -> string
-fromcharlist := [ len ] [ " " flip [ for_item i concat ] for ] [ pop ] ifthen
+fromcharlist := [ len ] [ " " flip [ for_item i concat ] for ] [ pop " " ] ifthen
 
 " NAMED REF MANIPULATION " pop
 " ====================== " pop
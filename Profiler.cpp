@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <iomanip>
+#include <csignal>
+#include <cstdlib>
+#include <gmp.h>
+#include <sys/time.h>
+
+#include "Profiler.h"
+
+Profiler::Profiler() {
+	Profiler::idFor("(top level)");
+	frames.push_back({ 0, Clock::now(), Clock::duration::zero() });
+}
+
+unsigned long Profiler::idFor(const std::string& name) {
+	auto id = ids.find(name);
+	if (id != ids.end()) {
+		return id->second;
+	}
+	ids[name] = names.size();
+	names.push_back(name);
+	entries.push_back(Entry());
+	return names.size() - 1;
+}
+
+void Profiler::enter(const std::string& name) {
+	unsigned long id = Profiler::idFor(name);
+	entries[id].calls++;
+	entries[id].active++;
+	edges[((unsigned long long)frames.back().id << 32) | id].calls++;
+	frames.push_back({ id, Clock::now(), Clock::duration::zero() });
+}
+
+void Profiler::exit() {
+	Clock::duration elapsed = Clock::now() - frames.back().start;
+	Frame frame = frames.back();
+	frames.pop_back();
+	Entry& entry = entries[frame.id];
+	entry.exclusive += elapsed - frame.children;
+	entry.active--;
+	if (entry.active == 0) {
+		entry.inclusive += elapsed;
+		edges[((unsigned long long)frames.back().id << 32) | frame.id].inclusive += elapsed;
+	}
+	frames.back().children += elapsed;
+}
+
+static double toMilliseconds(std::chrono::steady_clock::duration d) {
+	return std::chrono::duration<double, std::milli>(d).count();
+}
+
+void Profiler::print(std::ostream& out) {
+	//the percentages are of the time spent in calls, which is nearly all of it. top level
+	//code outside of them only pushes values
+	Clock::duration total = Clock::duration::zero();
+	for (const Entry& entry : entries) {
+		total += entry.exclusive;
+	}
+	std::vector<unsigned long> byExclusive;
+	for (unsigned long id = 1; id < entries.size(); id++) {
+		byExclusive.push_back(id);
+	}
+	std::sort(byExclusive.begin(), byExclusive.end(), [&](unsigned long a, unsigned long b) {
+		return entries[a].exclusive > entries[b].exclusive;
+	});
+	out << std::fixed << std::setprecision(3);
+	out << "flat profile:" << std::endl;
+	out << std::setw(12) << "calls" << std::setw(12) << "self ms" << std::setw(9) << "self %" << std::setw(12) << "total ms" << "  name" << std::endl;
+	for (unsigned long id : byExclusive) {
+		const Entry& entry = entries[id];
+		double percent = total == Clock::duration::zero() ? 0 : 100.0 * entry.exclusive.count() / total.count();
+		out << std::setw(12) << entry.calls << std::setw(12) << toMilliseconds(entry.exclusive) << std::setw(8) << std::setprecision(2) << percent << "%"
+			<< std::setprecision(3) << std::setw(12) << toMilliseconds(entry.inclusive) << "  " << names[id] << std::endl;
+	}
+
+	std::vector<std::pair<unsigned long long, Edge>> byCaller(edges.begin(), edges.end());
+	std::sort(byCaller.begin(), byCaller.end(), [&](const std::pair<unsigned long long, Edge>& a, const std::pair<unsigned long long, Edge>& b) {
+		const std::string& callerA = names[a.first >> 32];
+		const std::string& callerB = names[b.first >> 32];
+		if (callerA != callerB) {
+			return callerA < callerB;
+		}
+		return a.second.calls > b.second.calls;
+	});
+	out << "callers -> callees:" << std::endl;
+	out << std::setw(12) << "calls" << std::setw(12) << "total ms" << "  caller -> callee" << std::endl;
+	for (auto& edge : byCaller) {
+		out << std::setw(12) << edge.second.calls << std::setw(12) << toMilliseconds(edge.second.inclusive) << "  "
+			<< names[edge.first >> 32] << " -> " << names[edge.first & 0xffffffff] << std::endl;
+	}
+}
+
+SamplingProfiler* SamplingProfiler::running = nullptr;
+
+SamplingProfiler::SamplingProfiler(unsigned int hz, bool* ok) : depth(0), head(0), tail(0), dropped(0) {
+	running = this;
+	struct sigaction action = {};
+	action.sa_handler = SamplingProfiler::handleSignal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	struct itimerval timer = {};
+	timer.it_interval.tv_sec = hz == 1 ? 1 : 0;
+	timer.it_interval.tv_usec = hz == 1 ? 0 : 1000000 / hz;
+	timer.it_value = timer.it_interval;
+	*ok = sigaction(SIGPROF, &action, nullptr) == 0 && setitimer(ITIMER_PROF, &timer, nullptr) == 0;
+}
+
+void SamplingProfiler::handleSignal(int) {
+	if (running) {
+		running->takeSample();
+	}
+}
+
+void SamplingProfiler::takeSample() {
+	unsigned long h = head.load(std::memory_order_relaxed);
+	if (h - tail.load(std::memory_order_acquire) == RING_SIZE) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	Sample& sample = ring[h % RING_SIZE];
+	sample.depth = depth.load(std::memory_order_relaxed);
+	std::atomic_signal_fence(std::memory_order_acquire);
+	unsigned int recorded = std::min(sample.depth, MAX_DEPTH);
+	for (unsigned int i = 0; i < recorded; i++) {
+		sample.frames[i] = frames[i];
+	}
+	head.store(h + 1, std::memory_order_release);
+}
+
+void SamplingProfiler::tally() {
+	unsigned long h = head.load(std::memory_order_acquire);
+	for (unsigned long t = tail.load(std::memory_order_relaxed); t != h; t++) {
+		const Sample& sample = ring[t % RING_SIZE];
+		std::string stack = "(top level)";
+		for (unsigned int i = 0; i < std::min(sample.depth, MAX_DEPTH); i++) {
+			stack += ";" + *sample.frames[i];
+		}
+		if (sample.depth > MAX_DEPTH) {
+			stack += ";...";
+		}
+		folded[stack]++;
+		tail.store(t + 1, std::memory_order_release);
+	}
+}
+
+void SamplingProfiler::print(std::ostream& out) {
+	struct itimerval off = {};
+	setitimer(ITIMER_PROF, &off, nullptr);
+	running = nullptr;
+	SamplingProfiler::tally();
+	//a stack of its own, so the output is still valid folded stacks
+	if (dropped > 0) {
+		folded["(dropped)"] += dropped;
+	}
+	for (auto& stack : folded) {
+		out << stack.first << " " << stack.second << std::endl;
+	}
+}
+
+AllocationProfiler* AllocationProfiler::running = nullptr;
+thread_local bool AllocationProfiler::onProfiledThread = false;
+
+AllocationProfiler::AllocationProfiler() {
+	sites.push_back(Site());
+	sites.back().name = "(top level)";
+	ids[sites.back().name] = 0;
+	//blocks GMP already allocated came from malloc, so gmpFree can still free them
+	mp_set_memory_functions(AllocationProfiler::gmpAllocate, AllocationProfiler::gmpReallocate, AllocationProfiler::gmpFree);
+	onProfiledThread = true;
+	running = this;
+}
+
+void* AllocationProfiler::gmpAllocate(size_t size) {
+	if (running && onProfiledThread) {
+		running->record(size, true);
+	}
+	void* p = std::malloc(size);
+	if (!p) {
+		std::abort();
+	}
+	return p;
+}
+
+void* AllocationProfiler::gmpReallocate(void* p, size_t, size_t newSize) {
+	//growing a number is a new allocation as far as the count goes
+	if (running && onProfiledThread) {
+		running->record(newSize, true);
+	}
+	p = std::realloc(p, newSize);
+	if (!p) {
+		std::abort();
+	}
+	return p;
+}
+
+void AllocationProfiler::gmpFree(void* p, size_t) {
+	std::free(p);
+}
+
+unsigned long AllocationProfiler::enter(const std::string& name) {
+	unsigned long previous = current;
+	auto id = ids.find(name);
+	if (id != ids.end()) {
+		current = id->second;
+		return previous;
+	}
+	paused = true;
+	ids[name] = sites.size();
+	sites.push_back(Site());
+	sites.back().name = name;
+	paused = false;
+	current = sites.size() - 1;
+	return previous;
+}
+
+void AllocationProfiler::exit(unsigned long previous) {
+	current = previous;
+}
+
+void AllocationProfiler::print(std::ostream& out) {
+	running = nullptr;
+	std::vector<const Site*> byBytes;
+	for (const Site& site : sites) {
+		if (site.allocations > 0 || site.gmpAllocations > 0) {
+			byBytes.push_back(&site);
+		}
+	}
+	std::sort(byBytes.begin(), byBytes.end(), [](const Site* a, const Site* b) {
+		return a->bytes + a->gmpBytes > b->bytes + b->gmpBytes;
+	});
+	out << "allocations:" << std::endl;
+	out << std::setw(12) << "news" << std::setw(14) << "new bytes" << std::setw(12) << "gmp allocs" << std::setw(14) << "gmp bytes" << "  name" << std::endl;
+	for (const Site* site : byBytes) {
+		out << std::setw(12) << site->allocations << std::setw(14) << site->bytes << std::setw(12) << site->gmpAllocations << std::setw(14) << site->gmpBytes
+			<< "  " << site->name << std::endl;
+	}
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+//the --profile profiler. every call the runner makes (to a definition, a builtin or a
+//superinstruction) is timed, and attributed to its name and to whoever called it.
+//code that was inlined doesn't exist anymore at runtime, so it's counted as part of
+//whatever it was inlined into
+class Profiler {
+private:
+	typedef std::chrono::steady_clock Clock;
+	struct Entry {
+		unsigned long long calls = 0;
+		//time spent in it, including the functions it called. recursive calls are only
+		//counted once, by the outermost call
+		Clock::duration inclusive = Clock::duration::zero();
+		//time spent in it, not including the functions it called
+		Clock::duration exclusive = Clock::duration::zero();
+		//how many calls to it are running right now
+		unsigned int active = 0;
+	};
+	struct Edge {
+		unsigned long long calls = 0;
+		Clock::duration inclusive = Clock::duration::zero();
+	};
+	struct Frame {
+		unsigned long id;
+		Clock::time_point start;
+		Clock::duration children;
+	};
+
+	//everything called by name is given an id, 0 is top level code
+	std::unordered_map<std::string, unsigned long> ids;
+	std::vector<std::string> names;
+	std::vector<Entry> entries;
+	//keyed by caller id << 32 | callee id
+	std::unordered_map<unsigned long long, Edge> edges;
+	std::vector<Frame> frames;
+
+	unsigned long idFor(const std::string& name);
+public:
+	Profiler();
+	void enter(const std::string& name);
+	void exit();
+	//the flat profile sorted by exclusive time, then the caller -> callee table
+	void print(std::ostream& out);
+};
+
+//times a call for as long as it's in scope. with no profiler this is one branch
+//on the way in and one on the way out
+struct ProfileScope {
+	Profiler* profiler;
+	ProfileScope(Profiler* p, const std::string& name) : profiler(p) {
+		if (profiler) {
+			profiler->enter(name);
+		}
+	}
+	~ProfileScope() {
+		if (profiler) {
+			profiler->exit();
+		}
+	}
+};
+
+//the --sample-profile profiler. instead of timing every call, a SIGPROF timer interrupts
+//the program `hz` times a second (of cpu time) and records which definitions were running.
+//the runner keeps a stack of the definitions it's in, the signal handler copies that into a
+//ring buffer (it can't allocate or lock), and the samples are tallied into folded stacks
+//outside of the handler. builtins and inlined code count toward the definition they're in
+class SamplingProfiler {
+private:
+	//definitions nested deeper than this are cut off, and show up as one `...` frame
+	static constexpr unsigned int MAX_DEPTH = 128;
+	//samples the handler can get ahead of the tally by before they're dropped
+	static const unsigned int RING_SIZE = 512;
+	struct Sample {
+		unsigned int depth;
+		const std::string* frames[MAX_DEPTH];
+	};
+
+	//the definitions being run, outermost first. these point at the names in
+	//Runner::functionDefinitions, which are never removed
+	const std::string* frames[MAX_DEPTH];
+	std::atomic<unsigned int> depth;
+	//the handler writes at head, tally() reads at tail. only one thread ever touches
+	//these, so this is enough to keep the handler and the runner from stepping on each other
+	Sample ring[RING_SIZE];
+	std::atomic<unsigned long> head;
+	std::atomic<unsigned long> tail;
+	std::atomic<unsigned long long> dropped;
+	//"outer;inner" -> times it was sampled
+	std::map<std::string, unsigned long long> folded;
+
+	//the one the signal handler records into
+	static SamplingProfiler* running;
+	static void handleSignal(int);
+	void takeSample();
+	void tally();
+public:
+	//starts the timer. returns false in *ok if it couldn't be set up
+	SamplingProfiler(unsigned int hz, bool* ok);
+	inline void enter(const std::string* name) {
+		unsigned int d = depth.load(std::memory_order_relaxed);
+		if (d < MAX_DEPTH) {
+			frames[d] = name;
+		}
+		//the name has to be in place before the handler can see it
+		std::atomic_signal_fence(std::memory_order_release);
+		depth.store(d + 1, std::memory_order_relaxed);
+		poll();
+	}
+	inline void exit() {
+		depth.store(depth.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+		poll();
+	}
+	//tallies whatever the handler has recorded since the last time. enter and exit do this,
+	//and so does every iteration of a tail call loop, which can run for as long as it likes
+	//without entering or leaving anything
+	inline void poll() {
+		if (head.load(std::memory_order_relaxed) != tail.load(std::memory_order_relaxed)) {
+			SamplingProfiler::tally();
+		}
+	}
+	//stops the timer and prints one `outer;inner count` line per stack that was sampled,
+	//which is what flamegraph.pl and friends take
+	void print(std::ostream& out);
+};
+
+//keeps a definition on the sampling profiler's stack for as long as it's in scope
+struct SampleScope {
+	SamplingProfiler* sampler;
+	SampleScope(SamplingProfiler* s, const std::string& name) : sampler(s) {
+		if (sampler) {
+			sampler->enter(&name);
+		}
+	}
+	~SampleScope() {
+		if (sampler) {
+			sampler->exit();
+		}
+	}
+};
+
+//the --alloc-profile profiler. GMP's allocations (through mp_set_memory_functions) and
+//every operator new (replaced in main.cpp) are counted toward whichever builtin or
+//definition is running. only the thread that made it is counted, so parsing on worker
+//threads doesn't race with it
+class AllocationProfiler {
+private:
+	struct Site {
+		std::string name;
+		unsigned long long allocations = 0;
+		unsigned long long bytes = 0;
+		unsigned long long gmpAllocations = 0;
+		unsigned long long gmpBytes = 0;
+	};
+	//0 is top level code
+	std::unordered_map<std::string, unsigned long> ids;
+	std::vector<Site> sites;
+	unsigned long current = 0;
+	//set while the profiler's own bookkeeping allocates
+	bool paused = false;
+
+	static AllocationProfiler* running;
+	static thread_local bool onProfiledThread;
+	static void* gmpAllocate(size_t size);
+	static void* gmpReallocate(void* p, size_t oldSize, size_t newSize);
+	static void gmpFree(void* p, size_t size);
+	inline void record(size_t size, bool gmp) {
+		if (!paused) {
+			Site& site = sites[current];
+			(gmp ? site.gmpAllocations : site.allocations)++;
+			(gmp ? site.gmpBytes : site.bytes) += size;
+		}
+	}
+public:
+	//installs the GMP hooks and starts counting on this thread
+	AllocationProfiler();
+	//start counting toward `name`, returns what to go back to once it's done
+	unsigned long enter(const std::string& name);
+	void exit(unsigned long previous);
+	//called by operator new
+	static inline void recordNew(size_t size) {
+		if (running && onProfiledThread) {
+			running->record(size, false);
+		}
+	}
+	//stops counting, and prints every site sorted by bytes allocated
+	void print(std::ostream& out);
+};
+
+//counts allocations toward a call for as long as it's in scope
+struct AllocationScope {
+	AllocationProfiler* profiler;
+	unsigned long previous = 0;
+	AllocationScope(AllocationProfiler* p, const std::string& name) : profiler(p) {
+		if (profiler) {
+			previous = profiler->enter(name);
+		}
+	}
+	~AllocationScope() {
+		if (profiler) {
+			profiler->exit(previous);
+		}
+	}
+};
@@ -1,4 +1,5 @@
 #include <vector>
+#include <algorithm>
 
 #include "Runner.h"
 #include "ParserTypes.h"
@@ -7,16 +8,33 @@
 #include "Debug.h"
 #include "FFI.h"
 #include "FunctionAnalyzer.h"
+#include "ModuleCache.h"
+#include "Profiler.h"
+#include "Tracer.h"
 
 void Runner::addFunctionDefinition(FunctionDefinition fD) {
 	//first, check and make sure there's no other definition with
 	//the same name. if there is, overwrite it. if not, just push_back
 	//this definition.
 	if (functionDefinitions.find(fD.functionName) == functionDefinitions.end()) {
-		functionDefinitions[fD.functionName] = fD;
+		std::string name = fD.functionName;
+		functionDefinitions.emplace(std::move(name), std::move(fD));
 	}
 }
 
+std::shared_ptr<MemoCache> Runner::memoCacheFor(const std::string& name, FunctionAnalyzer* fA) {
+	//the definition's name is linked into the module's namespace, the declaration's isn't
+	const MemoDeclaration* memo = fA->getMemo(fA->unlinkedName(name));
+	if (memo == nullptr) {
+		return nullptr;
+	}
+	auto out = std::make_shared<MemoCache>();
+	out->capacity = memo->capacity;
+	out->pops = memo->pops;
+	out->pushes = memo->pushes;
+	return out;
+}
+
 Runner::Runner() {
 	//initialize the stacks
 	CharmFunction zero = Stack::zeroF();
@@ -24,6 +42,7 @@ Runner::Runner() {
 	stacks.push_back(Stack(zero));
 	pF = new PredefinedFunctions();
 	ffi = new FFI();
+	moduleCache = new ModuleCache();
 }
 
 bool Runner::doesStackExist(CharmFunction name) {
@@ -46,6 +65,9 @@ Stack* Runner::getCurrentStack() {
 void Runner::switchCurrentStack(CharmFunction name) {
 	if (Runner::doesStackExist(name)) {
 		Runner::currentStackName = name;
+		if (tracer && tracer->recording()) {
+			tracer->instant("stack", "switch to stack", charmFunctionToString(name));
+		}
 	} else {
 		runtime_die("Tried to switch to stack which does not exist.");
 	}
@@ -59,6 +81,59 @@ void Runner::createStack(CharmFunction name) {
 	}
 }
 
+std::vector<std::pair<std::string, unsigned long long>> Runner::getStats() {
+	std::vector<std::pair<std::string, unsigned long long>> out;
+	std::vector<std::pair<std::string, unsigned long long>> builtins;
+	unsigned long long builtinCalls = 0;
+	for (auto& builtin : pF->cppFunctionNames) {
+		if (builtin.second.calls > 0) {
+			builtins.push_back({ "calls to " + builtin.first, builtin.second.calls });
+			builtinCalls += builtin.second.calls;
+		}
+	}
+	//most called first, that's what's worth making a superinstruction out of
+	std::sort(builtins.begin(), builtins.end(), [](auto& a, auto& b) {
+		return a.second != b.second ? a.second > b.second : a.first < b.first;
+	});
+	out.push_back({ "builtin calls", builtinCalls });
+	out.insert(out.end(), builtins.begin(), builtins.end());
+	out.push_back({ "definition calls", stats.definitionCalls });
+	out.push_back({ "truthy ifthen branches", stats.truthyBranches });
+	out.push_back({ "falsy ifthen branches", stats.falsyBranches });
+	out.push_back({ "tail call iterations", stats.tailCallIterations });
+	out.push_back({ "refs", references.size() });
+	//the stacks only count these with --stats, so without it there's nothing to report
+	if (Stack::countPushes) {
+		unsigned long long pushedBytes[PUSHED_KINDS] = {};
+		for (const Stack& stack : stacks) {
+			out.push_back({ "peak depth of stack " + charmFunctionToString(stack.name), stack.peakDepth });
+			for (unsigned int kind = 0; kind < PUSHED_KINDS; kind++) {
+				pushedBytes[kind] += stack.pushedBytes[kind];
+			}
+		}
+		out.push_back({ "bytes of ints pushed", pushedBytes[INT_PUSHED] });
+		out.push_back({ "bytes of floats pushed", pushedBytes[FLOAT_PUSHED] });
+		out.push_back({ "bytes of strings pushed", pushedBytes[STRING_PUSHED] });
+		out.push_back({ "bytes of lists pushed", pushedBytes[LIST_PUSHED] });
+		out.push_back({ "bytes of other values pushed", pushedBytes[OTHER_PUSHED] });
+	}
+	return out;
+}
+
+void Runner::writeState(std::ostream& out) {
+	for (const Stack& stack : stacks) {
+		out << "stack " << charmFunctionToString(stack.name) << ":";
+		for (const CharmFunction& f : stack.stack) {
+			out << " " << charmFunctionToString(f);
+		}
+		out << std::endl;
+	}
+	for (const Reference& r : references) {
+		out << "ref " << charmFunctionToString(r.key) << ": " << charmFunctionToString(r.value) << std::endl;
+	}
+	out << "current stack " << charmFunctionToString(currentStackName) << std::endl;
+}
+
 CharmFunction Runner::getReference(CharmFunction key) {
 	for (Reference r : references) {
 		if (r.key == key) {
@@ -69,6 +144,9 @@ CharmFunction Runner::getReference(CharmFunction key) {
 }
 
 void Runner::setReference(CharmFunction key, CharmFunction value) {
+	if (tracer && tracer->recording()) {
+		tracer->instant("ref", "write ref", charmFunctionToString(key));
+	}
 	Reference newRef;
 	newRef.key = key;
 	newRef.value = value;
@@ -83,85 +161,127 @@ void Runner::setReference(CharmFunction key, CharmFunction value) {
 	references.push_back(newRef);
 }
 
-std::optional<std::vector<CharmFunction>> Runner::typeSignatureTick(std::string name, RunnerContext& context) {
-	std::optional<std::vector<CharmFunction>> out;
-	std::optional<CharmTypeSignature> type = context.fA->getTypeSignature(name);
-	ONLYDEBUG printf("RUNNING TYPESIGNATURETICK FOR %s\n", name.c_str());
-	if (type) {
-		//assign a vector to be checked by
-		unsigned int maxLength = FunctionAnalyzer::maxTypeSignatureLength(*type);
-		ONLYDEBUG printf("FOUND A TYPE SIGNATURE FOR %s OF MAX LENGTH %i\n", name.c_str(), maxLength);
-		//if the stack is small, make sure to just fake copying it with zero functions
-		if (Runner::getCurrentStack()->stack.size() < maxLength) {
-			out = std::vector<CharmFunction>(Runner::getCurrentStack()->stack.rbegin(), Runner::getCurrentStack()->stack.rend());
-			for (unsigned int i = 0; i < maxLength - Runner::getCurrentStack()->stack.size(); i++) {
-				out->push_back(Stack::zeroF());
-			}
-		} else {
-			out = std::vector<CharmFunction>(Runner::getCurrentStack()->stack.rbegin(), Runner::getCurrentStack()->stack.rbegin() + maxLength);
+//lists out the types of the top `length` values of the stack (deepest first) for type signature
+//errors. anything past the bottom of the stack is a zero, same as what pop would give
+static std::string stackTypesToString(const CHARM_STACK_TYPE& stack, unsigned int length) {
+	std::stringstream out;
+	for (unsigned int depth = length; depth-- > 0;) {
+		if (depth >= stack.size()) {
+			out << "int ";
+			continue;
 		}
-		std::reverse(out->begin(), out->end());
-		//check the popped values to see if they match up with a type signature
-		//NOTE: this is repeated in typeSignatureTock
-		//TODO: DRY
-		for (auto unit : type->units) {
-			bool isSignatureValid = true;
-			//check the type signature against the stack
-			for (unsigned int i = 0; i < unit.pops.size(); i++) {
-				auto popSig = unit.pops.at(i);
-				auto popStack = out->at(i);
-				if (popSig == TYPESIG_ANY) {
-					isSignatureValid = true;
-				} else if (popSig == TYPESIG_LIST) {
-					isSignatureValid = TYPESIG_LIST == charmFunctionToType(popStack);
-				} else if (popSig == TYPESIG_LISTSTRING) {
-					isSignatureValid = (TYPESIG_LIST == charmFunctionToType(popStack) || TYPESIG_STRING == charmFunctionToType(popStack));
-				} else if (popSig == TYPESIG_STRING) {
-					isSignatureValid = TYPESIG_STRING == charmFunctionToType(popStack);
-				} else if (popSig == TYPESIG_INT) {
-					isSignatureValid = TYPESIG_INT == charmFunctionToType(popStack);
-				} else if (popSig == TYPESIG_FLOAT) {
-					isSignatureValid = TYPESIG_FLOAT == charmFunctionToType(popStack);
-				}
-				if (!isSignatureValid) {
-					break;
-				}
+		const CharmFunction& f = stack[stack.size() - 1 - depth];
+		if (f.functionType == LIST_FUNCTION) {
+			out << "list ";
+		} else if (f.functionType == STRING_FUNCTION) {
+			out << "string ";
+		} else if (f.functionType == NUMBER_FUNCTION) {
+			if (f.numberValue.whichType == FLOAT_VALUE) {
+				out << "float ";
+			} else if (f.numberValue.whichType == INTEGER_VALUE) {
+				out << "int ";
 			}
-			// and if it's still valid by the time the types have been checked, then
-			// we return and don't error
-			if (isSignatureValid) {
-				return out;
+		}
+	}
+	return out.str();
+}
+
+//checks the types on the top of the stack against the signature's pops. this is run for
+//every call to a function with a type signature, so it doesn't copy or allocate anything
+//unless the check fails. returns which units matched as a bitmask, for typeSignatureTock
+unsigned long long Runner::typeSignatureTick(const CompiledTypeSignature& type) {
+	ONLYDEBUG printf("RUNNING TYPESIGNATURETICK FOR %s\n", type.signature.functionName.c_str());
+	const CHARM_STACK_TYPE& stack = Runner::getCurrentStack()->stack;
+	unsigned long long matchedUnits = 0;
+	for (unsigned int u = 0; u < type.units.size(); u++) {
+		const CompiledTypeSignatureUnit& unit = type.units[u];
+		bool isSignatureValid = true;
+		//pops[i] is checked against the value at depth maxLength - 1 - i. if the stack is
+		//too small, the missing values are zeros
+		for (unsigned int i = 0; i < unit.pops.size(); i++) {
+			unsigned long depth = type.maxLength - 1 - i;
+			unsigned int mask = depth < stack.size() ? charmFunctionToTypeMask(stack[stack.size() - 1 - depth]) : INT_TYPE;
+			if (!(mask & unit.pops[i])) {
+				isSignatureValid = false;
+				break;
 			}
 		}
+		if (isSignatureValid) {
+			matchedUnits |= 1ULL << u;
+		}
+	}
+	if (!matchedUnits) {
 		//if we exited the type signature checking function without finding a valid type signature
 		std::stringstream typeSigError;
-		typeSigError << "Type signature check for function `" << name << "` failed." << std::endl;
-		typeSigError << "The function has type signature `" << charmTypeSignatureToString(*type) << "` but it popped types `";
-		for (CharmFunction& f : (*out)) {
-			if (f.functionType == LIST_FUNCTION) {
-				typeSigError << "list ";
-			} else if (f.functionType == STRING_FUNCTION) {
-				typeSigError << "string ";
-			} else if (f.functionType == NUMBER_FUNCTION) {
-				if (f.numberValue.whichType == FLOAT_VALUE) {
-					typeSigError << "float ";
-				} else if (f.numberValue.whichType == INTEGER_VALUE) {
-					typeSigError << "int ";
-				}
+		typeSigError << "Type signature check for function `" << type.signature.functionName << "` failed." << std::endl;
+		typeSigError << "The function has type signature `" << charmTypeSignatureToString(type.signature) << "` but it popped types `";
+		typeSigError << stackTypesToString(stack, type.maxLength) << "`" << std::endl;
+		runtime_die(typeSigError.str());
+	}
+	return matchedUnits;
+}
+//and this checks what the function left on the stack against the pushes of the units that
+//matched in typeSignatureTick. the pushes are lined up with the top of the stack
+void Runner::typeSignatureTock(const CompiledTypeSignature& type, unsigned long long matchedUnits) {
+	ONLYDEBUG printf("RUNNING TYPESIGNATURETOCK FOR %s\n", type.signature.functionName.c_str());
+	const CHARM_STACK_TYPE& stack = Runner::getCurrentStack()->stack;
+	unsigned int maxPushes = 0;
+	for (unsigned int u = 0; u < type.units.size(); u++) {
+		if (!(matchedUnits & (1ULL << u))) {
+			continue;
+		}
+		const CompiledTypeSignatureUnit& unit = type.units[u];
+		bool isSignatureValid = true;
+		for (unsigned int i = 0; i < unit.pushes.size(); i++) {
+			unsigned long depth = unit.pushes.size() - 1 - i;
+			unsigned int mask = depth < stack.size() ? charmFunctionToTypeMask(stack[stack.size() - 1 - depth]) : INT_TYPE;
+			if (!(mask & unit.pushes[i])) {
+				isSignatureValid = false;
+				break;
 			}
 		}
-		typeSigError << "`" << std::endl;
-		runtime_die(typeSigError.str());
+		if (isSignatureValid) {
+			return;
+		}
+		maxPushes = std::max(maxPushes, (unsigned int)unit.pushes.size());
 	}
-	//this returns an empty std::option
-	return out;
+	std::stringstream typeSigError;
+	typeSigError << "Type signature check for function `" << type.signature.functionName << "` failed after it returned." << std::endl;
+	typeSigError << "The function has type signature `" << charmTypeSignatureToString(type.signature) << "` but it pushed types `";
+	typeSigError << stackTypesToString(stack, maxPushes) << "`" << std::endl;
+	runtime_die(typeSigError.str());
 }
-void Runner::typeSignatureTock(std::vector<CharmFunction> tick) {
 
+bool Runner::setTypeCheckMode(const std::string& mode) {
+	if (mode == "always") {
+		typeCheckMode = TYPECHECK_ALWAYS;
+	} else if (mode == "off") {
+		typeCheckMode = TYPECHECK_OFF;
+	} else if (mode.rfind("sample:", 0) == 0) {
+		std::string rate = mode.substr(7);
+		if (rate.empty() || rate.find_first_not_of("0123456789") != std::string::npos || std::stoull(rate) == 0) {
+			return false;
+		}
+		typeCheckMode = TYPECHECK_SAMPLE;
+		typeCheckSampleRate = std::stoull(rate);
+		typeCheckCallCount = 0;
+	} else {
+		return false;
+	}
+	//a call whose check might be skipped can't vouch for what it pushes
+	FunctionAnalyzer::arePushesChecked = typeCheckMode == TYPECHECK_ALWAYS;
+	return true;
 }
 
 
-void Runner::handleDefinedFunctions(CharmFunction f, RunnerContext context) {
+void Runner::tailCallIteration() {
+	stats.tailCallIterations++;
+	if (sampler) {
+		sampler->poll();
+	}
+}
+
+void Runner::handleDefinedFunctions(const CharmFunction& f, RunnerContext context) {
 	//PredefinedFunctions.h holds all the functions written in C++
 	//other than that, if these functions aren't built in, they are run through
 	//the functionDefinitions table.
@@ -183,8 +303,11 @@ void Runner::handleDefinedFunctions(CharmFunction f, RunnerContext context) {
 		//run the predefined function!
 		//(note: the function context AKA the definition we are running code from
 		//is passed in for tail call optimization in PredefinedFunctions.cpp::ifthen())
+		context.instruction = &f;
+		TraceScope traceScope(tracer, "builtin", f.functionName);
 		pF->functionLookup(f.functionName, this, context);
 	} else if (isFFIFunction) {
+		TraceScope traceScope(tracer, "ffi", f.functionName);
 		ffi->runFFI(f.functionName, this);
 	} else {
 		//alright, now we get down and dirty
@@ -200,8 +323,9 @@ void Runner::handleDefinedFunctions(CharmFunction f, RunnerContext context) {
 		}
 		auto possibleFunction = functionDefinitions.find(f.functionName);
 		if (possibleFunction != functionDefinitions.end()) {
-			FunctionDefinition fD = possibleFunction->second;
-			fD.functionBody = possibleFunction->second.functionBody;
+			const FunctionDefinition& fD = possibleFunction->second;
+			SampleScope sampleScope(sampler, fD.functionName);
+			TraceScope traceScope(tracer, "definition", fD.functionName, true);
 			//wait! before we run it, check and make sure this function isn't tail recursive
 			if (fD.definitionInfo.tailCallRecursive) {
 				//if it is, drop the last call to itself and just run it in a loop
@@ -209,6 +333,7 @@ void Runner::handleDefinedFunctions(CharmFunction f, RunnerContext context) {
 				CHARM_LIST_TYPE functionBodyCopy = fD.functionBody;
 				functionBodyCopy.pop_back();
 				while (1) {
+					tailCallIteration();
 					Runner::run(std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*>(functionBodyCopy, context.fA));
 				}
 			}
@@ -216,8 +341,13 @@ void Runner::handleDefinedFunctions(CharmFunction f, RunnerContext context) {
 			for (auto currentFunction : fD.functionBody) {
 				ONLYDEBUG printf("%s ", charmFunctionToString(currentFunction).c_str());
 			}
-			context.fD = fD;
+			context.fD = &fD;
 			context.inDefinition = true;
+			stats.definitionCalls++;
+			if (fD.memo) {
+				Runner::runMemoized(fD, context);
+				return;
+			}
 			//ooh. the only time we use this call!
 			Runner::runWithContext(fD.functionBody, context);
 		} else {
@@ -226,48 +356,15 @@ void Runner::handleDefinedFunctions(CharmFunction f, RunnerContext context) {
 	}
 }
 
-void Runner::addNamespacePrefix(CharmFunction& f, std::string ns) {
-	if (ns == "") {
-		return;
-	}
-	if (f.functionType == NUMBER_FUNCTION) {
-		return;
-	} else if (f.functionType == STRING_FUNCTION) {
-		return;
-	} else if (f.functionType == LIST_FUNCTION) {
-		for (CharmFunction& currentFunction : f.literalFunctions) {
-			addNamespacePrefix(currentFunction, ns);
-		}
-		return;
-	} else if (f.functionType == FUNCTION_DEFINITION) {
-		f.functionName = ns + f.functionName;
-		for (CharmFunction& currentFunction : f.literalFunctions) {
-			addNamespacePrefix(currentFunction, ns);
-		}
-		return;
-	} else if (f.functionType == DEFINED_FUNCTION) {
-		bool isAlreadyDefined = (functionDefinitions.find(f.functionName) != functionDefinitions.end());
-		bool isPredefinedFunction = (pF->cppFunctionNames.find(f.functionName) != pF->cppFunctionNames.end());
-		bool isFFIFunction = (ffi->mutateFFIFuncs.find(f.functionName) != ffi->mutateFFIFuncs.end());
-		ONLYDEBUG printf("isAlreadyDefined: %s, isPredefinedFunction: %s, isFFIFunction: %s\n", isAlreadyDefined ? "Yes" : "No", isPredefinedFunction ? "Yes" : "No", isFFIFunction ? "Yes" : "No");
-		if (isPredefinedFunction || isFFIFunction || isAlreadyDefined) {
-			//don't rename the function if it was defined globally outside of this file
-			//or it was already defined (aka: in the prelude)
-			//note: adding the "if already defined" clause ensures that functions from its own file don't trip the system,
-			//as those functions were already transformed and had their namespace prepended.
-		} else {
-			f.functionName = ns + f.functionName;
-		}
-	}
+bool Runner::isGlobalSymbol(const std::string& name) {
+	return (pF->cppFunctionNames.find(name) != pF->cppFunctionNames.end()) ||
+		(ffi->mutateFFIFuncs.find(name) != ffi->mutateFFIFuncs.end()) ||
+		(functionDefinitions.find(name) != functionDefinitions.end());
 }
 
-void Runner::runWithContext(CHARM_LIST_TYPE parsedProgram, RunnerContext& context, std::string ns) {
+void Runner::runWithContext(const CHARM_LIST_TYPE& parsedProgram, RunnerContext& context) {
 	context.fIndex = 0;
-	for (CharmFunction currentFunction : parsedProgram) {
-		if (ns != "") {
-			ONLYDEBUG printf("ADDING NAMESPACE %s\n", ns.c_str());
-			Runner::addNamespacePrefix(currentFunction, ns);
-		}
+	for (const CharmFunction& currentFunction : parsedProgram) {
 		//alright, now we get into the running portion
 		if (currentFunction.functionType == NUMBER_FUNCTION) {
 			ONLYDEBUG puts("RUNNING AS NUMBER_FUNCTION");
@@ -291,20 +388,34 @@ void Runner::runWithContext(CHARM_LIST_TYPE parsedProgram, RunnerContext& contex
 			tempFunction.functionName = currentFunction.functionName;
 			tempFunction.functionBody = currentFunction.literalFunctions;
 			tempFunction.definitionInfo = currentFunction.definitionInfo;
-			Runner::addFunctionDefinition(tempFunction);
-			ONLYDEBUG printf("ADDED FUNCTION DEFINITION FOR %s\n", tempFunction.functionName.c_str());
+			tempFunction.memo = Runner::memoCacheFor(tempFunction.functionName, context.fA);
+			Runner::addFunctionDefinition(std::move(tempFunction));
+			ONLYDEBUG printf("ADDED FUNCTION DEFINITION FOR %s\n", currentFunction.functionName.c_str());
 			//that was easy too! oh no...
 		} else if (currentFunction.functionType == DEFINED_FUNCTION) {
 			ONLYDEBUG puts("RUNNING AS DEFINED_FUNCTION");
-			//check the top of the stack before the function itself runs
-			auto tick = Runner::typeSignatureTick(currentFunction.functionName, context);
+			ProfileScope profileScope(profiler, currentFunction.functionName);
+			AllocationScope allocationScope(allocationProfiler, currentFunction.functionName);
+			//check the top of the stack before the function itself runs (unless FunctionAnalyzer
+			//already proved the check can't fail here, or --typecheck says to skip this call)
+			const CompiledTypeSignature* type = nullptr;
+			unsigned long long matchedUnits = 0;
+			if (currentFunction.typeChecked && typeCheckMode != TYPECHECK_OFF) {
+				type = context.fA->getCompiledTypeSignature(currentFunction.functionName);
+				if (type && typeCheckMode == TYPECHECK_SAMPLE && (typeCheckCallCount++ % typeCheckSampleRate) != 0) {
+					type = nullptr;
+				}
+				if (type) {
+					matchedUnits = Runner::typeSignatureTick(*type);
+				}
+			}
 			//let's do these defined functions now
 			Runner::handleDefinedFunctions(currentFunction, context);
 			//lol you thought i'd do it here
 			//check the stack at function's exit to make sure the type signature holds up
-			//if the optional is unset, there was no type sig provided so don't bother running this
-			if (tick) {
-				Runner::typeSignatureTock(*tick);
+			//if there's no type, there was no type sig provided so don't bother running this
+			if (type) {
+				Runner::typeSignatureTock(*type, matchedUnits);
 			}
 		}
 		context.fIndex++;
@@ -312,16 +423,92 @@ void Runner::runWithContext(CHARM_LIST_TYPE parsedProgram, RunnerContext& contex
 	ONLYDEBUG puts("EXITING RUNNER::RUN");
 }
 
-void Runner::run(std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> parsedProgramWithAnalyzer, std::string ns) {
+void Runner::runMemoized(const FunctionDefinition& fD, RunnerContext& context) {
+	MemoCache& memo = *fD.memo;
+	Stack* stack = Runner::getCurrentStack();
+	//the key is every value it pops, deepest first. values past the bottom of the stack
+	//are zeros, just like pop would give
+	std::string key;
+	for (unsigned int n = memo.pops; n > 0; n--) {
+		Runner::appendMemoKey(key, n <= stack->stack.size() ? stack->stack[stack->stack.size() - n] : Stack::zeroF());
+	}
+	auto cached = memo.index.find(key);
+	if (cached != memo.index.end()) {
+		memo.hits++;
+		memo.entries.splice(memo.entries.begin(), memo.entries, cached->second);
+		for (unsigned int n = 0; n < memo.pops; n++) {
+			stack->pop();
+		}
+		for (const CharmFunction& f : cached->second->second) {
+			stack->push(f);
+		}
+		return;
+	}
+	memo.misses++;
+	Runner::runWithContext(fD.functionBody, context);
+	//it's pure, so everything it did is in what it pushed
+	stack = Runner::getCurrentStack();
+	CHARM_LIST_TYPE result;
+	for (unsigned int n = memo.pushes; n > 0; n--) {
+		result.push_back(n <= stack->stack.size() ? stack->stack[stack->stack.size() - n] : Stack::zeroF());
+	}
+	//a recursive call with the same values could have gotten here first
+	if (memo.index.find(key) != memo.index.end()) {
+		return;
+	}
+	memo.entries.emplace_front(key, result);
+	memo.index[key] = memo.entries.begin();
+	if (memo.entries.size() > memo.capacity) {
+		memo.index.erase(memo.entries.back().first);
+		memo.entries.pop_back();
+	}
+}
+
+void Runner::appendMemoKey(std::string& key, const CharmFunction& f) {
+	key += std::to_string(f.functionType) + " ";
+	switch (f.functionType) {
+		case NUMBER_FUNCTION:
+		if (f.numberValue.whichType == INTEGER_VALUE) {
+			key += "i" + f.numberValue.integerValue.get_str() + " ";
+		} else {
+			long exponent;
+			std::string digits = f.numberValue.floatValue.get_str(exponent);
+			key += "f" + digits + "e" + std::to_string(exponent) + " ";
+		}
+		break;
+
+		case STRING_FUNCTION:
+		key += std::to_string(f.stringValue.size()) + " " + f.stringValue;
+		break;
+
+		case DEFINED_FUNCTION:
+		case FUNCTION_DEFINITION:
+		key += std::to_string(f.functionName.size()) + " " + f.functionName;
+		//fallthrough, superinstructions and definitions hold more in literalFunctions
+		case LIST_FUNCTION:
+		key += std::to_string(f.literalFunctions.size()) + " ";
+		for (const CharmFunction& child : f.literalFunctions) {
+			Runner::appendMemoKey(key, child);
+		}
+		break;
+	}
+}
+
+RunnerContext Runner::topLevelContext(FunctionAnalyzer* fA) {
 	RunnerContext rC;
-	rC.fA = parsedProgramWithAnalyzer.second;
-	
-	FunctionDefinition tempFD = FunctionDefinition();
-	tempFD.functionName = "";
-	tempFD.functionBody = CHARM_LIST_TYPE();
-	rC.fD = tempFD;
-	
+	rC.fA = fA;
+
+	//top level code isn't in any definition
+	static const FunctionDefinition topLevelFD = FunctionDefinition();
+	rC.fD = &topLevelFD;
+
 	rC.fIndex = 0;
 	rC.inDefinition = false;
-	Runner::runWithContext(parsedProgramWithAnalyzer.first, rC, ns);
+	rC.instruction = nullptr;
+	return rC;
+}
+
+void Runner::run(std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> parsedProgramWithAnalyzer) {
+	RunnerContext rC = Runner::topLevelContext(parsedProgramWithAnalyzer.second);
+	Runner::runWithContext(parsedProgramWithAnalyzer.first, rC);
 }
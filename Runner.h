@@ -1,6 +1,11 @@
 #pragma once
 #include <vector>
 #include <unordered_map>
+#include <optional>
+#include <list>
+#include <memory>
+#include <string>
+#include <ostream>
 #include "ParserTypes.h"
 #include "Stack.h"
 
@@ -10,17 +15,60 @@ class PredefinedFunctions;
 //in FFI.h
 class FFI;
 
+//in ModuleCache.h
+class ModuleCache;
+
+//in FunctionAnalyzer.h
+struct CompiledTypeSignature;
+
+//in Profiler.h
+class Profiler;
+class SamplingProfiler;
+class AllocationProfiler;
+
+//in Tracer.h
+class Tracer;
+
+//the results of a function declared with `memo`, keyed by the values it popped
+struct MemoCache {
+	unsigned long capacity;
+	unsigned int pops;
+	unsigned int pushes;
+	//most recently used first, so the last one is evicted when it's full
+	std::list<std::pair<std::string, CHARM_LIST_TYPE>> entries;
+	std::unordered_map<std::string, std::list<std::pair<std::string, CHARM_LIST_TYPE>>::iterator> index;
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
+};
+
+//counted as the runner goes, for `stats` and --stats. only the runner's own thread
+//touches these, so they're plain counters. calls to each builtin are counted in
+//BuiltinFunction::calls, and stack depths and pushed bytes in each Stack
+struct RunnerStats {
+	unsigned long long definitionCalls = 0;
+	unsigned long long truthyBranches = 0;
+	unsigned long long falsyBranches = 0;
+	//times a tail call ran as another go around a loop instead of as a call
+	unsigned long long tailCallIterations = 0;
+};
+
 struct FunctionDefinition {
 	std::string functionName;
 	CHARM_LIST_TYPE functionBody;
 	CharmFunctionDefinitionInfo definitionInfo;
+	//nullptr unless the function was declared with `memo`
+	std::shared_ptr<MemoCache> memo;
 };
 
 struct RunnerContext {
-	FunctionDefinition fD;
+	//the definition being run. this points into Runner::functionDefinitions (entries there
+	//are never replaced), so contexts stay cheap to copy
+	const FunctionDefinition* fD;
 	FunctionAnalyzer* fA;
 	unsigned long fIndex;
 	bool inDefinition;
+	//the call being run right now. superinstructions read their operands from this
+	const CharmFunction* instruction;
 };
 
 
@@ -34,7 +82,12 @@ class Runner {
 private:
 	//handle the functions that we don't know about
 	//and / or handle built in functions
-	void handleDefinedFunctions(CharmFunction f, RunnerContext context);
+	void handleDefinedFunctions(const CharmFunction& f, RunnerContext context);
+	//runs a memoized definition, or pushes what it returned last time it got the same values
+	void runMemoized(const FunctionDefinition& fD, RunnerContext& context);
+	//appends `f` to a memo cache key. every string is length prefixed and every list is
+	//prefixed with how many values it holds, so two keys are only equal for equal values
+	static void appendMemoKey(std::string& key, const CharmFunction& f);
 	//this is the name of the current stack that we
 	//are working with. by default, this is stack 0
 	CharmFunction currentStackName;
@@ -46,15 +99,48 @@ public:
 	Runner();
 	//and this is how you add them
 	void addFunctionDefinition(FunctionDefinition fD);
+	//a fresh cache if `fA` has a memo declaration for `name`, otherwise nullptr
+	static std::shared_ptr<MemoCache> memoCacheFor(const std::string& name, FunctionAnalyzer* fA);
 
 	//all of our instances containing any sort of functions are right here:
 	PredefinedFunctions* pF;
 	FFI* ffi;
+	ModuleCache* moduleCache;
+	RunnerStats stats;
+	//every count in stats, in the builtins and in the stacks, as (what it counts, count)
+	//pairs. this is what the `stats` builtin pushes and what --stats prints
+	std::vector<std::pair<std::string, unsigned long long>> getStats();
+	//every stack (bottom first) and ref, in the order they were made, and which stack is
+	//current. this is what --dump-state writes, to diff one run of a program against another
+	void writeState(std::ostream& out);
+	//nullptr unless --profile was passed
+	Profiler* profiler = nullptr;
+	//nullptr unless --sample-profile was passed
+	SamplingProfiler* sampler = nullptr;
+	//every tail call loop calls this once per iteration. a loop never enters or leaves a
+	//definition, so this is also where the sampling profiler gets to tally what it's recorded
+	void tailCallIteration();
+	//nullptr unless --alloc-profile was passed
+	AllocationProfiler* allocationProfiler = nullptr;
+	//nullptr unless --trace was passed
+	Tracer* tracer = nullptr;
 	std::unordered_map<std::string, FunctionDefinition> functionDefinitions;
 
 	//type signature runtime checking
-	std::optional<std::vector<CharmFunction>> typeSignatureTick(std::string name, RunnerContext& context);
-	void typeSignatureTock(std::vector<CharmFunction> tick);
+	unsigned long long typeSignatureTick(const CompiledTypeSignature& type);
+	void typeSignatureTock(const CompiledTypeSignature& type, unsigned long long matchedUnits);
+	//which calls get checked at runtime, set with --typecheck. sampling checks every Nth
+	//call to a function with a type signature
+	enum TypeCheckMode {
+		TYPECHECK_ALWAYS,
+		TYPECHECK_SAMPLE,
+		TYPECHECK_OFF
+	};
+	TypeCheckMode typeCheckMode = TYPECHECK_ALWAYS;
+	unsigned long long typeCheckSampleRate = 1;
+	unsigned long long typeCheckCallCount = 0;
+	//takes "always", "off" or "sample:N". returns false if the mode isn't one of those
+	bool setTypeCheckMode(const std::string& mode);
 
 	const unsigned int MAX_STACK = 20000;
 	bool doesStackExist(CharmFunction name);
@@ -65,7 +151,14 @@ public:
 	CharmFunction getReference(CharmFunction key);
 	void setReference(CharmFunction key, CharmFunction value);
 
-	void addNamespacePrefix(CharmFunction& f, std::string ns);
-	void runWithContext(CHARM_LIST_TYPE parsedProgram, RunnerContext& context, std::string ns = "");
-	void run(std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> parsedProgramWithAnalyzer, std::string ns = "");
+	//whether a name refers to something outside of any namespace: a builtin,
+	//an FFI function or something already defined (ex: in the prelude)
+	bool isGlobalSymbol(const std::string& name);
+
+	//namespaces are applied once when a module is loaded (see ModuleCache.cpp),
+	//so running code never has to care about them
+	void runWithContext(const CHARM_LIST_TYPE& parsedProgram, RunnerContext& context);
+	void run(std::pair<CHARM_LIST_TYPE, FunctionAnalyzer*> parsedProgramWithAnalyzer);
+	//the context that top level code (not in any definition) is run with
+	static RunnerContext topLevelContext(FunctionAnalyzer* fA);
 };
@@ -51,8 +51,44 @@ CharmFunction Stack::pop() {
 	return Stack::zeroF();
 }
 
+unsigned long long Stack::valueBytes(const CharmFunction& f) {
+	//strings this short are stored inside the std::string
+	static const unsigned long long inlineCapacity = std::string().capacity();
+	unsigned long long bytes = sizeof(CharmFunction);
+	bytes += f.numberValue.integerValue.get_mpz_t()->_mp_alloc * sizeof(mp_limb_t);
+	bytes += (f.numberValue.floatValue.get_mpf_t()->_mp_prec + 1) * sizeof(mp_limb_t);
+	if (f.stringValue.capacity() > inlineCapacity) {
+		bytes += f.stringValue.capacity() + 1;
+	}
+	if (f.functionName.capacity() > inlineCapacity) {
+		bytes += f.functionName.capacity() + 1;
+	}
+	bytes += f.literalFunctions.capacity() * sizeof(CharmFunction);
+	return bytes;
+}
+
+bool Stack::countPushes = false;
+
+void Stack::updatePeakDepth() {
+	if (Stack::countPushes && Stack::stack.size() > Stack::peakDepth) {
+		Stack::peakDepth = Stack::stack.size();
+	}
+}
+
 void Stack::push(CharmFunction f) {
-	Stack::stack.push_back(f);
+	if (Stack::countPushes) {
+		PushedKind kind = OTHER_PUSHED;
+		if (f.functionType == NUMBER_FUNCTION) {
+			kind = f.numberValue.whichType == INTEGER_VALUE ? INT_PUSHED : FLOAT_PUSHED;
+		} else if (f.functionType == STRING_FUNCTION) {
+			kind = STRING_PUSHED;
+		} else if (f.functionType == LIST_FUNCTION) {
+			kind = LIST_PUSHED;
+		}
+		Stack::pushedBytes[kind] += Stack::valueBytes(f);
+	}
+	Stack::stack.push_back(std::move(f));
+	Stack::updatePeakDepth();
 }
 
 void Stack::swap(unsigned long long n1, unsigned long long n2) {
@@ -60,6 +96,10 @@ void Stack::swap(unsigned long long n1, unsigned long long n2) {
 	if (n1 == n2) {
 		return;
 	}
+	// an empty stack is all zeros, so there's nothing to swap
+	if (Stack::stack.size() == 0) {
+		return;
+	}
 	unsigned long stackLastElem = Stack::stack.size() - 1;
 	// we gotta handle 4 cases as follows:
 	// the first one: both n1 and n2 are outside the actual stack size
@@ -79,6 +119,7 @@ void Stack::swap(unsigned long long n1, unsigned long long n2) {
 			Stack::stack.push_front(Stack::zeroF());
 		}
 	}
+	Stack::updatePeakDepth();
 	// then we swap
 	std::iter_swap(Stack::stack.end() - n1 - 1, Stack::stack.end() - n2 - 1);
 	// and we're on our merry way
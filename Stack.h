@@ -2,10 +2,32 @@
 #include "ParserTypes.h"
 #include <deque>
 
+//what `stats` breaks the bytes pushed onto a stack down by
+enum PushedKind {
+    INT_PUSHED,
+    FLOAT_PUSHED,
+    STRING_PUSHED,
+    LIST_PUSHED,
+    OTHER_PUSHED,
+    PUSHED_KINDS
+};
+
 class Stack {
 private:
+    //the CharmFunction itself, plus whatever its number, strings and list hold on to
+    //on the heap (but not what the values in the list hold)
+    static unsigned long long valueBytes(const CharmFunction& f);
 public:
     CharmFunction name;
+    //whether push keeps peakDepth and pushedBytes up to date. sizing every value costs
+    //something on every push, so it's off unless --stats turns it on
+    static bool countPushes;
+    //the most values the stack has ever held. anything that grows the stack without push
+    //(swap padding it with zeros, `bench` putting back a saved stack) calls updatePeakDepth
+    unsigned long long peakDepth = 1;
+    //how many bytes of values have been pushed onto the stack, by kind. only values that
+    //go through push are counted, so the zeros swap pads the stack with aren't
+    unsigned long long pushedBytes[PUSHED_KINDS] = {};
     Stack(CharmFunction name);
     //the stack is automatically initialized to MAX_INT zero ints
     CHARM_STACK_TYPE stack;
@@ -23,6 +45,8 @@ public:
     static CharmFunction zeroF();
     //push to top of stack
     void push(CharmFunction f);
+    //raise peakDepth to the stack's size, if counting
+    void updatePeakDepth();
     //pop off top of stack
     CharmFunction pop();
     //swap values at index n1 and n2 from the top (zero-indexed)
@@ -0,0 +1,117 @@
+#include <cstdio>
+#include <iomanip>
+#include <fnmatch.h>
+
+#include "Tracer.h"
+
+thread_local Tracer::Buffer* Tracer::threadBuffer = nullptr;
+
+Tracer::Tracer(const std::string& f) : epoch(Clock::now()), filter(f) {}
+
+Tracer::Buffer* Tracer::buffer() {
+	if (threadBuffer == nullptr) {
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		buffers.push_back(std::make_unique<Buffer>());
+		buffers.back()->tid = buffers.size();
+		threadBuffer = buffers.back().get();
+	}
+	return threadBuffer;
+}
+
+void Tracer::add(Event&& event) {
+	Buffer* b = Tracer::buffer();
+	if (b->events.size() < RING_SIZE) {
+		b->events.push_back(std::move(event));
+	} else {
+		b->events[b->written % RING_SIZE] = std::move(event);
+	}
+	b->written++;
+}
+
+void Tracer::enterDefinition(const std::string& name) {
+	if (filter.empty()) {
+		return;
+	}
+	auto match = filterMatches.find(name);
+	if (match == filterMatches.end()) {
+		match = filterMatches.emplace(name, fnmatch(filter.c_str(), name.c_str(), 0) == 0).first;
+	}
+	if (match->second) {
+		matchedDepth++;
+	}
+}
+
+void Tracer::exitDefinition(const std::string& name) {
+	if (filter.empty()) {
+		return;
+	}
+	//enterDefinition already looked this one up
+	if (filterMatches[name]) {
+		matchedDepth--;
+	}
+}
+
+void Tracer::complete(const char* category, const std::string& name, Clock::time_point start, const std::string& detail) {
+	Clock::time_point now = Clock::now();
+	Tracer::add({ 'X', category, name, detail, start - epoch, now - start });
+}
+
+void Tracer::instant(const char* category, const std::string& name, const std::string& detail) {
+	Tracer::add({ 'i', category, name, detail, Clock::now() - epoch, Clock::duration::zero() });
+}
+
+void Tracer::writeEscaped(std::ostream& out, const std::string& s) {
+	out << '"';
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		} else if ((unsigned char)c < 0x20) {
+			char escaped[7];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out << escaped;
+		} else {
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+static double toMicroseconds(Tracer::Clock::duration d) {
+	return std::chrono::duration<double, std::micro>(d).count();
+}
+
+void Tracer::write(std::ostream& out) {
+	std::lock_guard<std::mutex> lock(buffersMutex);
+	out << std::fixed << std::setprecision(3);
+	out << "{\"traceEvents\":[";
+	bool first = true;
+	for (auto& b : buffers) {
+		//name the threads, and say how much the ring lost
+		out << (first ? "" : ",") << "\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << b->tid
+			<< ",\"args\":{\"name\":\"" << (b->tid == 1 ? "runner" : "thread " + std::to_string(b->tid)) << "\"}}";
+		first = false;
+		if (b->written > RING_SIZE) {
+			out << ",\n{\"ph\":\"i\",\"s\":\"t\",\"cat\":\"trace\",\"name\":\"" << b->written - RING_SIZE
+				<< " earlier events were dropped\",\"pid\":1,\"tid\":" << b->tid << ",\"ts\":0}";
+		}
+		unsigned long oldest = b->written > RING_SIZE ? b->written % RING_SIZE : 0;
+		for (unsigned long n = 0; n < b->events.size(); n++) {
+			const Event& event = b->events[(oldest + n) % b->events.size()];
+			out << ",\n{\"ph\":\"" << event.phase << "\",\"cat\":\"" << event.category << "\",\"name\":";
+			Tracer::writeEscaped(out, event.name);
+			out << ",\"pid\":1,\"tid\":" << b->tid << ",\"ts\":" << toMicroseconds(event.start);
+			if (event.phase == 'X') {
+				out << ",\"dur\":" << toMicroseconds(event.duration);
+			} else {
+				out << ",\"s\":\"t\"";
+			}
+			if (!event.detail.empty()) {
+				out << ",\"args\":{\"detail\":";
+				Tracer::writeEscaped(out, event.detail);
+				out << "}";
+			}
+			out << "}";
+		}
+	}
+	out << "\n]}" << std::endl;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+#include <unordered_map>
+
+//the --trace tracer. while it's on, the runner records an event for every definition and
+//builtin it runs, every ffi call and include, and every stack switch and ref write, then
+//writes them all out on exit in chrome's trace event format (open it in chrome://tracing or
+//https://ui.perfetto.dev). every thread records into its own ring buffer, so a long program
+//only keeps its last RING_SIZE events per thread
+class Tracer {
+public:
+	typedef std::chrono::steady_clock Clock;
+private:
+	static const unsigned long RING_SIZE = 1 << 18;
+	struct Event {
+		//'X' for something that took time, 'i' for something that just happened
+		char phase;
+		//what kind of thing happened, this is what the viewer colors by
+		const char* category;
+		std::string name;
+		//shown as the event's "detail" argument, empty if there isn't one
+		std::string detail;
+		Clock::duration start;
+		Clock::duration duration;
+	};
+	struct Buffer {
+		unsigned long tid;
+		std::vector<Event> events;
+		//including the ones the ring has since written over
+		unsigned long long written = 0;
+	};
+
+	Clock::time_point epoch;
+	//only taken when a thread records its first event
+	std::mutex buffersMutex;
+	std::vector<std::unique_ptr<Buffer>> buffers;
+	//the tracer owns the buffers, so they're still around to be written out after
+	//their threads are gone
+	static thread_local Buffer* threadBuffer;
+	Buffer* buffer();
+	void add(Event&& event);
+
+	//a glob (see fnmatch(3)), only definitions matching it and whatever they run
+	//are recorded. empty to record everything
+	std::string filter;
+	std::unordered_map<std::string, bool> filterMatches;
+	//how many matching definitions the runner is inside of
+	unsigned long matchedDepth = 0;
+
+	static void writeEscaped(std::ostream& out, const std::string& s);
+public:
+	Tracer(const std::string& filter);
+
+	inline bool recording() {
+		return filter.empty() || matchedDepth > 0;
+	}
+	//a definition is being run, or is done running. these keep track of the filter
+	void enterDefinition(const std::string& name);
+	void exitDefinition(const std::string& name);
+
+	//something that started at `start` and ended just now
+	void complete(const char* category, const std::string& name, Clock::time_point start, const std::string& detail = "");
+	//something that happened just now
+	void instant(const char* category, const std::string& name, const std::string& detail = "");
+
+	//{"traceEvents": [...]}, oldest events first
+	void write(std::ostream& out);
+};
+
+//records a complete event for as long as it's in scope. with no tracer this is one branch
+//on the way in and one on the way out
+struct TraceScope {
+	Tracer* tracer;
+	const char* category;
+	const std::string& name;
+	bool definition;
+	bool recorded = false;
+	Tracer::Clock::time_point start;
+	TraceScope(Tracer* t, const char* c, const std::string& n, bool d = false) : tracer(t), category(c), name(n), definition(d) {
+		if (tracer) {
+			if (definition) {
+				tracer->enterDefinition(name);
+			}
+			if (tracer->recording()) {
+				recorded = true;
+				start = Tracer::Clock::now();
+			}
+		}
+	}
+	~TraceScope() {
+		if (tracer) {
+			if (recorded) {
+				tracer->complete(category, name, start);
+			}
+			if (definition) {
+				tracer->exitDefinition(name);
+			}
+		}
+	}
+};
@@ -0,0 +1,291 @@
+//the in process benchmark suite, built and run by `make bench`. every case runs one
+//operation (a builtin with its operands already pushed, a whole tail call loop, a lex of a
+//whole program...) over and over straight through a Runner, with no shelling out and nothing
+//but libcharmffi.a and the standard library
+//
+//each case is warmed up by doubling how many operations a sample runs until a sample takes
+//at least --sample-ms, then that many operations are timed --reps times. the median and
+//median absolute deviation of those samples are printed per operation, and written to
+//--json=<file> for comparing runs over time
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+#include "../Runner.h"
+#include "../Parser.h"
+#include "../Stack.h"
+#include "../FunctionAnalyzer.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Case {
+	std::string name;
+	//run once before anything is timed, to fill the runner with refs, definitions...
+	std::function<void(Runner&, Parser&)> setup;
+	//the operation being timed
+	std::function<void(Runner&, Parser&)> op;
+};
+
+struct Result {
+	std::string name;
+	unsigned long long iterations;
+	std::vector<double> samples;
+	double median;
+	double mad;
+};
+
+static CharmFunction integer(const mpz_class& n) {
+	CharmFunction f;
+	f.functionType = NUMBER_FUNCTION;
+	f.numberValue.whichType = INTEGER_VALUE;
+	f.numberValue.integerValue = n;
+	return f;
+}
+
+static CharmFunction string(const std::string& s) {
+	CharmFunction f;
+	f.functionType = STRING_FUNCTION;
+	f.stringValue = s;
+	return f;
+}
+
+static CharmFunction list(unsigned long size) {
+	CharmFunction f;
+	f.functionType = LIST_FUNCTION;
+	for (unsigned long n = 0; n < size; n++) {
+		f.literalFunctions.push_back(integer(n));
+	}
+	return f;
+}
+
+static CHARM_LIST_TYPE call(const std::string& name) {
+	CharmFunction f;
+	f.functionType = DEFINED_FUNCTION;
+	f.functionName = name;
+	return { f };
+}
+
+//the runner path a builtin really goes through: dispatch, the builtin, and its pushes and pops
+static void run(Runner& r, Parser& p, const CHARM_LIST_TYPE& code) {
+	RunnerContext context = Runner::topLevelContext(p.getFunctionAnalyzer());
+	r.runWithContext(code, context);
+}
+
+static double median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	unsigned long mid = values.size() / 2;
+	return values.size() % 2 == 1 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+static Result measure(const Case& c, unsigned int reps, double sampleMs) {
+	Runner r;
+	Parser p;
+	c.setup(r, p);
+	auto sample = [&](unsigned long long iterations) {
+		Clock::time_point start = Clock::now();
+		for (unsigned long long n = 0; n < iterations; n++) {
+			c.op(r, p);
+		}
+		return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	};
+	//warmup, which also finds how many operations make a long enough sample
+	unsigned long long iterations = 1;
+	while (sample(iterations) < sampleMs * 1e6 && iterations < (1ULL << 32)) {
+		iterations *= 2;
+	}
+	Result result;
+	result.name = c.name;
+	result.iterations = iterations;
+	for (unsigned int rep = 0; rep < reps; rep++) {
+		result.samples.push_back(sample(iterations) / iterations);
+	}
+	result.median = median(result.samples);
+	std::vector<double> deviations;
+	for (double s : result.samples) {
+		deviations.push_back(std::fabs(s - result.median));
+	}
+	result.mad = median(deviations);
+	return result;
+}
+
+static std::vector<Case> cases() {
+	std::vector<Case> out;
+	auto nothing = [](Runner&, Parser&) {};
+
+	out.push_back({ "push pop", nothing, [](Runner& r, Parser&) {
+		r.getCurrentStack()->push(integer(1));
+		r.getCurrentStack()->pop();
+	} });
+
+	//arithmetic on ints that fit in a limb, and on 512 bit ones
+	const mpz_class small = 12345;
+	const mpz_class large = (mpz_class(1) << 512) - 12345;
+	for (std::string op : { "+", "-", "*", "/" }) {
+		for (bool isLarge : { false, true }) {
+			CHARM_LIST_TYPE code = call(op);
+			mpz_class a = isLarge ? large : small;
+			mpz_class b = isLarge ? mpz_class(large >> 7) : mpz_class(123);
+			out.push_back({ op + (isLarge ? " large" : " small"), nothing, [=](Runner& r, Parser& p) {
+				r.getCurrentStack()->push(integer(a));
+				r.getCurrentStack()->push(integer(b));
+				run(r, p, code);
+				r.getCurrentStack()->pop();
+			} });
+		}
+	}
+
+	//swapping the top with something deeper, then back
+	for (unsigned long depth : { 1, 10, 100, 1000 }) {
+		CHARM_LIST_TYPE code = call("swap");
+		out.push_back({ "swap depth " + std::to_string(depth), [=](Runner& r, Parser&) {
+			for (unsigned long n = 0; n <= depth; n++) {
+				r.getCurrentStack()->push(integer(n));
+			}
+		}, [=](Runner& r, Parser& p) {
+			for (int twice = 0; twice < 2; twice++) {
+				r.getCurrentStack()->push(integer(0));
+				r.getCurrentStack()->push(integer(depth));
+				run(r, p, code);
+			}
+		} });
+	}
+
+	//refs are looked up by name, so get and set the last one made
+	for (unsigned long refs : { 1, 10, 100, 1000 }) {
+		auto setup = [=](Runner& r, Parser&) {
+			for (unsigned long n = 0; n < refs; n++) {
+				r.setReference(string("ref" + std::to_string(n)), integer(n));
+			}
+		};
+		CharmFunction last = string("ref" + std::to_string(refs - 1));
+		CHARM_LIST_TYPE getref = call("getref");
+		CHARM_LIST_TYPE setref = call("setref");
+		out.push_back({ "getref " + std::to_string(refs) + " refs", setup, [=](Runner& r, Parser& p) {
+			r.getCurrentStack()->push(last);
+			run(r, p, getref);
+			r.getCurrentStack()->pop();
+		} });
+		out.push_back({ "setref " + std::to_string(refs) + " refs", setup, [=](Runner& r, Parser& p) {
+			r.getCurrentStack()->push(last);
+			r.getCurrentStack()->push(integer(1));
+			run(r, p, setref);
+		} });
+	}
+
+	for (unsigned long size : { 10, 100, 1000, 10000 }) {
+		CharmFunction l = list(size);
+		CHARM_LIST_TYPE concat = call("concat");
+		CHARM_LIST_TYPE split = call("split");
+		CHARM_LIST_TYPE at = call("at");
+		out.push_back({ "concat " + std::to_string(size), nothing, [=](Runner& r, Parser& p) {
+			r.getCurrentStack()->push(l);
+			r.getCurrentStack()->push(l);
+			run(r, p, concat);
+			r.getCurrentStack()->pop();
+		} });
+		out.push_back({ "split " + std::to_string(size), nothing, [=](Runner& r, Parser& p) {
+			r.getCurrentStack()->push(l);
+			r.getCurrentStack()->push(integer(size / 2));
+			run(r, p, split);
+			r.getCurrentStack()->pop();
+			r.getCurrentStack()->pop();
+		} });
+		out.push_back({ "at " + std::to_string(size), nothing, [=](Runner& r, Parser& p) {
+			r.getCurrentStack()->push(l);
+			r.getCurrentStack()->push(integer(size / 2));
+			run(r, p, at);
+			r.getCurrentStack()->pop();
+			r.getCurrentStack()->pop();
+		} });
+	}
+
+	//a whole countdown from 1000 to 0, once compiled to %ifthen and once run as plain ifthen
+	for (bool branch : { true, false }) {
+		out.push_back({ std::string("ifthen tail call loop 1000") + (branch ? "" : " (no branch pass)"), [=](Runner& r, Parser& p) {
+			FunctionAnalyzer::setPassEnabled("branch", branch);
+			r.run(p.lex("countdown := [ dup ] [ 1 - countdown ] [ ] ifthen"));
+			FunctionAnalyzer::setPassEnabled("branch", true);
+		}, [](Runner& r, Parser& p) {
+			r.getCurrentStack()->push(integer(1000));
+			run(r, p, call("countdown"));
+			r.getCurrentStack()->pop();
+		} });
+	}
+
+	//lexing (and optimizing) a 1000 line program
+	std::string program;
+	for (int line = 0; line < 1000; line++) {
+		program += std::to_string(line) + " 2 + 3 * pop [ 4 5 \" str \" [ 6 ] ] len pop pop \" a string \" pop\n";
+	}
+	out.push_back({ "lex 1000 lines", nothing, [=](Runner&, Parser& p) {
+		p.lex(program);
+	} });
+	return out;
+}
+
+static void writeJSON(std::ostream& out, const std::vector<Result>& results, unsigned int reps) {
+	out << std::setprecision(6);
+	out << "{\"repetitions\":" << reps << ",\"benchmarks\":[";
+	for (unsigned long n = 0; n < results.size(); n++) {
+		const Result& result = results[n];
+		out << (n == 0 ? "" : ",") << "\n{\"name\":\"" << result.name << "\",\"iterations\":" << result.iterations
+			<< ",\"median_ns\":" << result.median << ",\"mad_ns\":" << result.mad << ",\"samples_ns\":[";
+		for (unsigned long s = 0; s < result.samples.size(); s++) {
+			out << (s == 0 ? "" : ",") << result.samples[s];
+		}
+		out << "]}";
+	}
+	out << "\n]}" << std::endl;
+}
+
+int main(int argc, char const *argv[]) {
+	unsigned int reps = 15;
+	double sampleMs = 10;
+	std::string jsonPath;
+	std::string filter;
+	for (int n = 1; n < argc; n++) {
+		std::string arg = argv[n];
+		if (arg.rfind("--reps=", 0) == 0) {
+			reps = std::max(1, std::stoi(arg.substr(7)));
+		} else if (arg.rfind("--sample-ms=", 0) == 0) {
+			sampleMs = std::stod(arg.substr(12));
+		} else if (arg.rfind("--json=", 0) == 0) {
+			jsonPath = arg.substr(7);
+		} else if (arg.rfind("--filter=", 0) == 0) {
+			filter = arg.substr(9);
+		} else {
+			std::cout << "Usage: " << argv[0] << " [--reps=N] [--sample-ms=MS] [--json=FILE] [--filter=SUBSTRING]" << std::endl;
+			return -1;
+		}
+	}
+
+	std::vector<Result> results;
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << std::setw(44) << std::left << "benchmark" << std::right << std::setw(14) << "median ns" << std::setw(12) << "mad ns" << std::setw(12) << "iterations" << std::endl;
+	for (const Case& c : cases()) {
+		if (c.name.find(filter) == std::string::npos) {
+			continue;
+		}
+		results.push_back(measure(c, reps, sampleMs));
+		const Result& result = results.back();
+		std::cout << std::setw(44) << std::left << result.name << std::right << std::setw(14) << result.median << std::setw(12) << result.mad
+			<< std::setw(12) << result.iterations << std::endl;
+	}
+
+	if (!jsonPath.empty()) {
+		std::ofstream json(jsonPath);
+		if (!json) {
+			std::cout << "Couldn't write " << jsonPath << std::endl;
+			return -1;
+		}
+		writeJSON(json, results, reps);
+	}
+	return 0;
+}
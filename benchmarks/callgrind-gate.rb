@@ -0,0 +1,189 @@
+# Runs every program in the corpus under callgrind and compares how many instructions each
+# one took against callgrind-baseline.txt. Instruction counts don't care how busy the machine
+# is, so this catches the few percent regressions that wall clock benchmarks can't.
+#
+#   ruby callgrind-gate.rb [--threshold=PERCENT]   fail if any program got more than PERCENT
+#                                                   (2 by default) slower than the baseline
+#   ruby callgrind-gate.rb --update                 record a new baseline
+#   ruby callgrind-gate.rb --compare OLD NEW        diff two callgrind output files, like the
+#                                                   callgrind-* files in this directory
+#
+# Run it from the benchmarks/ directory, it uses ../charm (and builds it if it isn't there).
+
+require "tmpdir"
+
+CORPUS = ["fib.charm", "fib-fast.charm", "ps.charm"] + Dir.glob("corpus/*.charm").sort
+BASELINE = "callgrind-baseline.txt"
+# how many of each program's most expensive functions go in the baseline
+FUNCTIONS_KEPT = 40
+# how many functions to show when something regressed
+FUNCTIONS_SHOWN = 15
+
+# Reads a callgrind output file, and returns [total instructions, { function => instructions
+# spent in it, not counting what it called }].
+def parseCallgrind(path)
+    names = {}
+    self_costs = Hash.new(0)
+    total = nil
+    function = nil
+    # the cost line after a calls= line is what the call cost, which belongs to the callee
+    skip_next_cost = false
+    File.foreach(path) do |line|
+        line = line.chomp
+        case line
+        when /^(c?fn)=\((\d+)\)(?: (.*))?$/
+            names[$2] = $3 if $3
+            if $1 == "fn"
+                function = names[$2]
+            end
+        when /^calls=/
+            skip_next_cost = true
+        when /^(summary|totals): (\d+)/
+            total = $2.to_i
+        when /^[0-9+\-*]/
+            cost = line.split(" ")[1].to_i
+            if skip_next_cost
+                skip_next_cost = false
+            elsif function
+                self_costs[function] += cost
+            end
+        end
+    end
+    total ||= self_costs.values.sum
+    [total, self_costs]
+end
+
+# Prints every function whose cost changed, biggest change first.
+def printFunctionDiff(old_costs, new_costs)
+    changes = (old_costs.keys | new_costs.keys).map do |function|
+        [function, old_costs.fetch(function, 0), new_costs.fetch(function, 0)]
+    end
+    changes.reject! { |_, old, new| old == new }
+    changes.sort_by! { |_, old, new| -(new - old).abs }
+    changes.first(FUNCTIONS_SHOWN).each do |function, old, new|
+        percent = old == 0 ? "new" : format("%+.2f%%", 100.0 * (new - old) / old)
+        puts format("    %+15d  %9s  %s", new - old, percent, function)
+    end
+end
+
+def runCallgrind(program)
+    Dir.mktmpdir do |dir|
+        out = File.join(dir, "callgrind.out")
+        # the module cache would make the first run different from the rest
+        env = { "CHARM_CACHE_DIR" => dir }
+        unless system(env, "valgrind", "--tool=callgrind", "--callgrind-out-file=#{out}", "../charm", program,
+                      out: File::NULL, err: File::NULL)
+            puts "callgrind failed on #{program}."
+            exit -1
+        end
+        parseCallgrind(out)
+    end
+end
+
+def readBaseline
+    baseline = {}
+    File.foreach(BASELINE) do |line|
+        next if line.start_with?("#")
+        kind, program, cost, function = line.chomp.split(" ", 4)
+        baseline[program] ||= [0, {}]
+        if kind == "program"
+            baseline[program][0] = cost.to_i
+        else
+            baseline[program][1][function] = cost.to_i
+        end
+    end
+    baseline
+end
+
+def writeBaseline(results)
+    File.open(BASELINE, "w") do |f|
+        f.puts "# instructions per program (and its most expensive functions), written by callgrind-gate.rb --update"
+        results.each do |program, (total, functions)|
+            f.puts "program #{program} #{total}"
+            functions.sort_by { |_, cost| -cost }.first(FUNCTIONS_KEPT).each do |function, cost|
+                f.puts "function #{program} #{cost} #{function}"
+            end
+        end
+    end
+end
+
+threshold = 2.0
+update = false
+args = ARGV.dup
+if args.first == "--compare"
+    if args.size != 3
+        puts "Usage: ruby callgrind-gate.rb --compare OLD NEW"
+        exit -1
+    end
+    old_total, old_costs = parseCallgrind(args[1])
+    new_total, new_costs = parseCallgrind(args[2])
+    puts format("%d -> %d instructions (%+.2f%%)", old_total, new_total, 100.0 * (new_total - old_total) / old_total)
+    printFunctionDiff(old_costs, new_costs)
+    exit 0
+end
+args.each do |arg|
+    if arg.start_with?("--threshold=")
+        threshold = arg.split("=", 2)[1].to_f
+    elsif arg == "--update"
+        update = true
+    else
+        puts "Unknown argument #{arg}."
+        exit -1
+    end
+end
+
+# without a baseline there's nothing to gate on, so don't spend minutes under callgrind first
+if !update && !File.exist?(BASELINE)
+    puts "There's no #{BASELINE}, so there's nothing to compare against. Record one with"
+    puts "`make callgrind-gate CALLGRIND_ARGS=--update` on a build you trust, and commit it."
+    exit -1
+end
+unless system("which valgrind", out: File::NULL)
+    puts "valgrind isn't installed, so there's nothing to measure with."
+    exit -1
+end
+unless File.exist?("../charm")
+    Dir.chdir("../") do
+        unless system("make release")
+            puts "Couldn't build charm. Make sure that we're in the benchmarks/ directory."
+            exit -1
+        end
+    end
+end
+
+results = {}
+CORPUS.each do |program|
+    results[program] = runCallgrind(program)
+end
+
+if update
+    writeBaseline(results)
+    puts "Wrote #{BASELINE}."
+    exit 0
+end
+baseline = readBaseline
+failed = false
+results.each do |program, (total, functions)|
+    # a program the baseline doesn't know about isn't gated at all, which is a failure too
+    unless baseline[program]
+        puts format("%-24s %15d  NOT IN THE BASELINE, run with --update to add it", program, total)
+        failed = true
+        next
+    end
+    old_total, old_functions = baseline[program]
+    percent = 100.0 * (total - old_total) / old_total
+    regressed = percent > threshold
+    puts format("%-24s %15d  %+.2f%%%s", program, total, percent, regressed ? "  REGRESSED" : "")
+    if regressed
+        failed = true
+        # the baseline only has the most expensive functions, so leave out the cheap ones that
+        # would otherwise look new
+        cheapest = old_functions.values.min || 0
+        printFunctionDiff(old_functions, functions.select { |function, cost| old_functions.key?(function) || cost >= cheapest })
+    end
+end
+(baseline.keys - results.keys).each do |program|
+    puts format("%-24s %15s  IN THE BASELINE BUT NOT THE CORPUS, run with --update to drop it", program, "")
+    failed = true
+end
+exit(failed ? 1 : 0)
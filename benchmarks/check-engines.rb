@@ -0,0 +1,451 @@
+# Differential testing for the optimizer. Every program in the corpus, plus a batch of randomly
+# generated well typed ones, is run once with every optimization pass turned off (the
+# reference) and once per engine: all the passes on, each pass on by itself, and each pass off
+# by itself. The output, exit status, and every stack and ref left at exit (see --dump-state)
+# have to match the reference byte for byte. A random program that doesn't match is shrunk
+# down to a minimal one that still doesn't, and written to check-engines-failures/.
+#
+# Every engine also runs each corpus program through an `include`, twice with the same module
+# cache: once to build the module and once more to load it back from the disk cache.
+#
+# With REFERENCE_CHARM=PATH set, the reference is that charm instead (built from a commit you
+# trust), run with its default flags, and ../charm with every pass off is checked like any
+# other engine. If it's too old to know --dump-state, the state isn't compared.
+#
+#   ruby check-engines.rb [--programs=N] [--seed=N] [--timeout=SECONDS] [--no-shrink]
+#
+# Run it from the benchmarks/ directory, it uses ../charm (and builds it if it isn't there).
+
+require "tmpdir"
+require "fileutils"
+
+CHARM = File.expand_path("../charm", __dir__)
+CORPUS = ["fib.charm", "fib-fast.charm", "ps.charm"] + Dir.glob("corpus/*.charm").sort + ["../test/include/main.charm"]
+FAILURES_DIR = "check-engines-failures"
+PASSES = ["typecheck", "fold", "peephole", "permute", "inline", "branch"]
+
+def disabling(passes)
+    passes.empty? ? [] : ["--disable-opt", passes.join(",")]
+end
+
+ENGINES = [["all passes on", []]] +
+    PASSES.map { |pass| ["only #{pass}", disabling(PASSES - [pass])] } +
+    PASSES.map { |pass| ["all but #{pass}", disabling([pass])] }
+REFERENCE_CHARM = ENV.fetch("REFERENCE_CHARM", "").empty? ? nil : File.expand_path(ENV["REFERENCE_CHARM"])
+if REFERENCE_CHARM
+    REFERENCE = [REFERENCE_CHARM, []]
+    ENGINES.unshift(["all passes off", disabling(["all"])])
+else
+    REFERENCE = [CHARM, disabling(["all"])]
+end
+
+def clock
+    Process.clock_gettime(Process::CLOCK_MONOTONIC)
+end
+
+# Runs the program at `path` with `flags`, from the program's own directory so that includes
+# work. returns everything that has to match: the exit status, stdout, stderr and the state.
+# `cache` is the module cache to use, by default every run gets its own so that no engine
+# runs what another one compiled
+def runEngine(path, flags, timeout, charm: CHARM, cache: nil, program: File.basename(path))
+    Dir.mktmpdir do |dir|
+        state = File.join(dir, "state")
+        out = File.join(dir, "out")
+        err = File.join(dir, "err")
+        env = { "CHARM_CACHE_DIR" => cache || File.join(dir, "cache") }
+        pid = spawn(env, charm, "--dump-state=#{state}", *flags, program,
+                    chdir: File.dirname(path), in: File::NULL, out: out, err: err)
+        start = clock
+        status = nil
+        while (finished = Process.waitpid2(pid, Process::WNOHANG)).nil?
+            if clock - start > timeout
+                Process.kill("KILL", pid)
+                Process.waitpid(pid)
+                status = "timed out"
+                break
+            end
+            sleep 0.001
+        end
+        status ||= finished[1].exitstatus ? "exited with #{finished[1].exitstatus}" : "killed by signal #{finished[1].termsig}"
+        {
+            "status" => status,
+            "stdout" => File.binread(out),
+            "stderr" => File.binread(err),
+            "state" => File.exist?(state) ? File.binread(state) : "",
+        }
+    end
+end
+
+def runReference(path, timeout)
+    result = runEngine(path, REFERENCE[1], timeout, charm: REFERENCE[0])
+    result.delete("state") unless $referenceDumpsState
+    result
+end
+
+# runs `" <program> " " included: " include` next to the program at `path`, twice with the
+# same module cache. the first run builds the module, the second loads it from disk
+def runIncluded(path, flags, timeout)
+    Dir.mktmpdir do |dir|
+        wrapper = File.join(dir, "include.charm")
+        File.write(wrapper, "\" #{File.basename(path)} \" \" included: \" include\n")
+        cache = File.join(dir, "cache")
+        ["through include", "through include, from the disk cache"].map do |how|
+            [how, runEngine(path, flags, timeout, cache: cache, program: wrapper)]
+        end
+    end
+end
+
+# what differs between two runs, nil if nothing does. only what the reference has is compared
+def difference(reference, result)
+    part = reference.keys.find { |key| reference[key] != result[key] }
+    return nil unless part
+    expected = reference[part].lines
+    got = result[part].lines
+    line = (0...[expected.size, got.size].max).find { |n| expected[n] != got[n] }
+    "#{part} differs at line #{line + 1}:\n" \
+    "    reference: #{(expected[line] || "(nothing)").chomp}\n" \
+    "    engine:    #{(got[line] || "(nothing)").chomp}"
+end
+
+# Makes random programs that always type check, by keeping track of the type of everything on
+# every stack while it writes them. values are ints, strings and lists of ints. lists know
+# their length, so split and at always get an index in range, and `/` never gets a zero divisor
+class ProgramGenerator
+    def initialize(random)
+        @random = random
+    end
+
+    def pick(array)
+        array[@random.rand(array.size)]
+    end
+
+    def chance(percent)
+        @random.rand(100) < percent
+    end
+
+    def smallInt
+        @random.rand(-20..20)
+    end
+
+    def word
+        (1..@random.rand(1..4)).map { pick(("a".."f").to_a) }.join
+    end
+
+    # code that takes an int off the top of the stack and leaves an int there instead
+    def intToInt(depth = 0)
+        choices = [
+            -> { "#{smallInt} +" },
+            -> { "#{smallInt} -" },
+            -> { "#{@random.rand(-3..3)} *" },
+            -> { "#{pick([-7, -2, 1, 3, 5])} / #{pick(["pop", "flip pop"])}" },
+            -> { "abs" },
+            -> { "dup +" },
+            -> { "dup pop" },
+            -> { "#{smallInt} flip flip pop" },
+            -> { "#{smallInt} eq" },
+            -> { "#{smallInt} flip -" },
+            -> { "tostring len flip pop" },
+            -> { "[ #{smallInt} + ] i" },
+            -> { "\" #{pick(@refs)} \" getref pop" },
+        ]
+        choices += @definitions.map { |name| -> { name } }
+        if depth < 2
+            choices += [
+                -> { "[ dup ] [ #{intToInt(depth + 1)} ] [ #{intToInt(depth + 1)} ] ifthen" },
+                -> { "[ #{intToInt(depth + 1)} ] #{@random.rand(0..3)} repeat i" },
+                -> { "dup #{intToInt(depth + 1)} #{pick(["+", "-", "eq"])}" },
+            ]
+        end
+        (1..@random.rand(1..3)).map { pick(choices).call }.join(" ")
+    end
+
+    def definitions(count)
+        @definitions = []
+        lines = []
+        count.times do |n|
+            name = "f#{n}"
+            # a tail call loop, that adds to an accumulator a few times
+            if chance(25)
+                times = @random.rand(0..30)
+                lines << "#{name}_loop := [ dup ] [ 1 - flip #{intToInt(1)} flip #{name}_loop ] [ ] ifthen"
+                lines << "#{name} := #{times} #{name}_loop pop"
+            else
+                # now and then the signature is wrong about what it pushes, which has to be
+                # caught the same way whether the call is inlined or not
+                lines << "#{name} :: int -> #{chance(90) ? "int" : "string"}" if chance(50)
+                lines << "#{name} := #{intToInt}"
+            end
+            @definitions << name
+        end
+        lines
+    end
+
+    # pushes a random value, and returns [code, type]
+    def value
+        case @random.rand(3)
+        when 0
+            n = smallInt
+            [n.to_s, [:int]]
+        when 1
+            s = word
+            ["\" #{s} \"", [:string, s.size]]
+        else
+            items = (1..@random.rand(0..4)).map { smallInt }
+            ["[ #{items.join(" ")} ]".squeeze(" "), [:list, items.size]]
+        end
+    end
+
+    # one statement of the main program, given the types on the current stack. returns the code
+    # and changes `stack` (and the current stack and refs) to match
+    def statement(stack)
+        top = stack.last
+        second = stack[-2]
+        choices = []
+        choices << -> { code, type = value; stack.push(type); code }
+        choices << -> { stack.pop; "pop" } if stack.size > 1
+        choices << -> { stack.push(top); "dup" } unless stack.empty?
+        choices << -> { stack.pop; "p" } if stack.size > 1
+        choices << -> { stack[-1], stack[-2] = second, top; "flip" } if stack.size >= 2
+        if stack.size >= 3
+            choices << lambda do
+                a, b = @random.rand(0...stack.size), @random.rand(0...stack.size)
+                stack[-1 - a], stack[-1 - b] = stack[-1 - b], stack[-1 - a]
+                "#{a} #{b} swap"
+            end
+        end
+        if top == [:int]
+            choices << -> { intToInt }
+            choices << -> { stack.pop; stack.push([:string, nil]); "tostring" }
+            if second == [:int]
+                choices << -> { stack.pop; pick(["+", "-", "*", "eq"]) }
+            end
+        end
+        if top && [:list, :string].include?(top[0])
+            choices << -> { stack.push([:int]); "len" }
+            if top[0] == :list && top[1] && top[1] > 0
+                choices << -> { stack.push([:list, 1]); "#{@random.rand(0...top[1])} at" }
+            end
+            # split checks its index against a list's length even when it's given a string, so
+            # strings can't be split anywhere but 0
+            if top[0] == :list && top[1]
+                choices << lambda do
+                    index = @random.rand(0..top[1])
+                    stack.pop
+                    stack.push([top[0], index], [top[0], top[1] - index])
+                    "#{index} split"
+                end
+            end
+            if second && second[0] == top[0]
+                choices << lambda do
+                    stack.pop
+                    stack[-1] = [top[0], second[1] && top[1] && second[1] + top[1]]
+                    "concat"
+                end
+            end
+        end
+        unless stack.empty?
+            choices << lambda do
+                ref = pick(@refs)
+                @refTypes[ref] = stack.pop
+                "\" #{ref} \" flip setref"
+            end
+        end
+        choices << lambda do
+            ref = pick(@refs)
+            stack.push(@refTypes[ref])
+            "\" #{ref} \" getref"
+        end
+        choices << lambda do
+            name = pick(@stacks.keys)
+            @current = name
+            # stack 0 is named by an int
+            name == "0" ? "0 switchstack" : "\" #{name} \" switchstack"
+        end
+        pick(choices).call
+    end
+
+    def program
+        @refs = ["r0", "r1", "r2"]
+        @refTypes = Hash.new([:int])
+        lines = []
+        # refs start out as ints, so definitions can read them
+        @refs.each { |ref| lines << "\" #{ref} \" #{smallInt} setref"; @refTypes[ref] = [:int] }
+        lines += definitions(@random.rand(0..5))
+        @stacks = { "0" => [[:int]] }
+        @current = "0"
+        @random.rand(0..2).times do |n|
+            name = "s#{n}"
+            lines << "\" #{name} \" createstack"
+            @stacks[name] = [[:int]]
+        end
+        @random.rand(3..12).times do
+            line = (1..@random.rand(1..6)).map { statement(@stacks[@current]) }.join(" ")
+            lines << line
+        end
+        lines.join("\n") + "\n"
+    end
+end
+
+# Splits a line into the pieces that can be taken out of it without leaving it unbalanced:
+# single words, whole string literals and whole lists. lists are split up too, so what's in
+# them can be taken out. each piece is [first token, last token]
+def removablePieces(tokens)
+    pieces = []
+    open = []
+    n = 0
+    while n < tokens.size
+        case tokens[n]
+        when "\""
+            close = ((n + 1)...tokens.size).find { |m| tokens[m] == "\"" } || tokens.size - 1
+            pieces << [n, close]
+            n = close
+        when "["
+            open.push(n)
+        when "]"
+            pieces << [open.pop, n] unless open.empty?
+        else
+            pieces << [n, n]
+        end
+        n += 1
+    end
+    # the biggest pieces first, they take the most out at once
+    pieces.sort_by { |first, last| first - last }
+end
+
+# Takes lines out of the program, then pieces out of lines, for as long as `fails` keeps
+# saying the smaller program still fails.
+def shrink(program, &fails)
+    lines = program.lines.map(&:chomp)
+    chunk = lines.size / 2
+    while chunk >= 1
+        n = 0
+        while n < lines.size
+            smaller = lines[0...n] + lines[(n + chunk)..]
+            if fails.call(smaller.join("\n") + "\n")
+                lines = smaller
+            else
+                n += chunk
+            end
+        end
+        chunk /= 2
+    end
+    lines.each_index do |n|
+        loop do
+            tokens = lines[n].split(" ")
+            # definitions keep their name and :=
+            fixed = tokens[1] == ":=" ? 2 : 0
+            shrunk = removablePieces(tokens).any? do |first, last|
+                next false if first < fixed
+                line = (tokens[0...first] + tokens[(last + 1)..]).join(" ")
+                smaller = lines.dup
+                smaller[n] = line
+                if fails.call(smaller.join("\n") + "\n")
+                    lines = smaller
+                    true
+                end
+            end
+            break unless shrunk
+        end
+    end
+    lines.reject(&:empty?).join("\n") + "\n"
+end
+
+programs = 100
+seed = Random.new_seed % 1_000_000
+timeout = 10
+shrinking = true
+ARGV.each do |arg|
+    if arg.start_with?("--programs=")
+        programs = arg.split("=", 2)[1].to_i
+    elsif arg.start_with?("--seed=")
+        seed = arg.split("=", 2)[1].to_i
+    elsif arg.start_with?("--timeout=")
+        timeout = arg.split("=", 2)[1].to_f
+    elsif arg == "--no-shrink"
+        shrinking = false
+    else
+        puts "Unknown argument #{arg}."
+        exit -1
+    end
+end
+
+unless File.exist?(CHARM)
+    Dir.chdir("../") do
+        unless system("make release")
+            puts "Couldn't build charm. Make sure that we're in the benchmarks/ directory."
+            exit -1
+        end
+    end
+end
+
+if REFERENCE_CHARM
+    unless File.exist?(REFERENCE_CHARM)
+        puts "There's no reference charm at #{REFERENCE_CHARM}."
+        exit -1
+    end
+    Dir.mktmpdir do |dir|
+        path = File.join(dir, "empty.charm")
+        File.write(path, "")
+        $referenceDumpsState = !runEngine(path, [], timeout, charm: REFERENCE_CHARM)["state"].empty?
+    end
+    puts "The reference is #{REFERENCE_CHARM}#{$referenceDumpsState ? "" : ", which can't dump its state, so that isn't compared"}."
+else
+    $referenceDumpsState = true
+end
+
+failures = 0
+CORPUS.each do |program|
+    path = File.expand_path(program)
+    reference = runReference(path, timeout)
+    ENGINES.each do |engine, flags|
+        runs = [["", runEngine(path, flags, timeout)]] + runIncluded(path, flags, timeout).map { |how, result| [", #{how}", result] }
+        runs.each do |how, result|
+            diff = difference(reference, result)
+            next unless diff
+            failures += 1
+            puts "#{program} (#{engine}#{how}): #{diff}"
+        end
+    end
+end
+puts "#{CORPUS.size} corpus programs run through #{ENGINES.size} engines, directly and through an include."
+
+puts "Random programs from seed #{seed}."
+random = Random.new(seed)
+generator = ProgramGenerator.new(random)
+Dir.mktmpdir do |dir|
+    path = File.join(dir, "program.charm")
+    programs.times do |n|
+        program = generator.program
+        File.write(path, program)
+        reference = runReference(path, timeout)
+        ENGINES.each do |engine, flags|
+            diff = difference(reference, runEngine(path, flags, timeout))
+            next unless diff
+            failures += 1
+            puts "random program #{n} (#{engine}): #{diff}"
+            if shrinking
+                # the smaller program has to still run (or not run) the same way under the
+                # reference, so it doesn't shrink into some other failure
+                program = shrink(program) do |smaller|
+                    File.write(path, smaller)
+                    smallerReference = runReference(path, timeout)
+                    smallerReference["status"] == reference["status"] &&
+                        difference(smallerReference, runEngine(path, flags, timeout))
+                end
+            end
+            FileUtils.mkdir_p(FAILURES_DIR)
+            failure = File.join(FAILURES_DIR, "seed-#{seed}-program-#{n}.charm")
+            File.write(failure, program)
+            puts "    #{shrinking ? "shrunk to" : "written to"} #{failure}, run it with ../charm #{flags.join(" ")}"
+            # one engine is enough to go on
+            break
+        end
+    end
+end
+puts "#{programs} random programs run through #{ENGINES.size} engines."
+
+if failures > 0
+    puts "#{failures} runs didn't match the reference."
+    exit 1
+end
+puts "Every engine matched the reference."
@@ -6,8 +6,12 @@
 #include <deque>
 #include <optional>
 #include <algorithm>
+#include <iomanip>
 #include <string_view>
 #include <functional>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
 
 #ifdef CHARM_GUI
 	#include "gui.h"
@@ -20,6 +24,9 @@
 
 #include "Parser.h"
 #include "Runner.h"
+#include "FunctionAnalyzer.h"
+#include "Profiler.h"
+#include "Tracer.h"
 #include "Debug.h"
 
 const std::string VERSION = "0.3.0";
@@ -30,6 +37,7 @@ struct CommandLineLambda {
 	static inline bool runArg() {
 		auto iter = std::find(arg->begin(), arg->end(), *flag);
 		if (iter != arg->end()) {
+			arg->erase(iter);
 			(*f)();
 			return true;
 		}
@@ -45,7 +53,7 @@ struct CommandLineOptional {
 		if (iter != arg->end()) {
 			if (
 				iter == std::prev(arg->end()) ||
-				std::next(iter)->front() == '-'
+				(std::next(iter)->size() > 0 && std::next(iter)->front() == '-')
 			) {
 				std::cout << "No argument supplied to " << *flag << std::endl;
 				return false;
@@ -59,10 +67,69 @@ struct CommandLineOptional {
 	}
 };
 
+//for flags that take their argument as --flag=value
+template<std::vector<std::string>* arg, std::string* flag, std::optional<std::string>* var>
+struct CommandLineValue {
+	static inline void runArg() {
+		auto iter = std::find_if(arg->begin(), arg->end(), [](const std::string& a) {
+			return a.rfind(*flag + "=", 0) == 0;
+		});
+		if (iter != arg->end()) {
+			(*var) = iter->substr(flag->size() + 1);
+			arg->erase(iter);
+		}
+	}
+};
+
+//the -n and -p modes. the program is lexed once, then run against every line of stdin
+//with that line pushed as a string. with printRecords, the top of the stack is popped
+//and printed after each line
+static int runRecordFilter(Parser& parser, Runner& runner, const std::string& program, bool printRecords) {
+	//records are read from cin, the same stream the `getline` builtin reads from, so a program
+	//can take the next line for itself. nothing here uses stdio, so cin and cout can buffer
+	std::ios::sync_with_stdio(false);
+	try {
+		runner.run(parser.lex(prelude));
+	} catch (std::exception &e) {
+		std::cout << "Prelude.charm nonexistant or unopenable. This shouldn't ever happen! Please report it to the charm devs." << std::endl;
+		std::cout << "Error: " << e.what() << std::endl << std::endl;
+		return -1;
+	}
+	try {
+		auto parsedProgram = parser.lex(program);
+		RunnerContext context = Runner::topLevelContext(parsedProgram.second);
+		CharmFunction record;
+		record.functionType = STRING_FUNCTION;
+
+		auto runRecord = [&]() {
+			runner.getCurrentStack()->push(record);
+			runner.runWithContext(parsedProgram.first, context);
+			if (printRecords) {
+				CharmFunction out = runner.getCurrentStack()->pop();
+				if (out.functionType == STRING_FUNCTION) {
+					std::cout << out.stringValue << '\n';
+				} else {
+					std::cout << charmFunctionToString(out) << '\n';
+				}
+			}
+		};
+
+		//a last line with no newline at the end is still a record
+		while (std::getline(std::cin, record.stringValue)) {
+			runRecord();
+		}
+	} catch (std::exception &e) {
+		std::cout << "Error: " << e.what() << std::endl;
+		return -1;
+	}
+	std::cout.flush();
+	return 0;
+}
 
 int main(int argc, char const *argv[]) {
 	Parser parser = Parser();
-	Runner runner = Runner();
+	//static, so it's still around when the --stats report is printed on exit
+	static Runner runner = Runner();
 
 	//parse command line arguments
 	static std::vector<std::string> args;
@@ -74,13 +141,28 @@ int main(int argc, char const *argv[]) {
 		puts("By @Aearnus");
 		puts("Usage:");
 		puts("    charm [flags] [input file]");
+		puts("    charm [flags] -");
 		puts("Note:");
 		puts("    Calling charm without an input file starts a REPL in most situations.");
+		puts("    Passing - as the input file reads the program from stdin (see --stream).");
 		puts("Flags:");
 		puts("    -h: Print this help message.");
 		puts("    -v: Print the version.");
-		puts("    -a <function name>: Analyze a function from the input file and print out information about it.");
+		puts("    -a <function name>: Analyze a function from the input file and print out information about it (ex: how the inliner treated it, and its side effects), after running the file.");
 		puts("    -f <file path>: Load up a file to be used interactively in the REPL.");
+		puts("    --stream: Read the program from stdin, running each line as soon as it arrives.");
+		puts("    -n <program>: Run the program once for every line of stdin, with the line pushed as a string.");
+		puts("    -p <program>: Like -n, but pop and print the top of the stack after every line.");
+		puts("    --disable-opt <passes>: Turn off a comma separated list of optimization passes (typecheck, fold, peephole, permute, inline, branch, or all).");
+		puts("    --opt-report: Print how many times each optimization fired to stderr on exit.");
+		puts("    --stats: Print how many builtins, definitions, branches and tail calls ran, how deep each stack got and how many bytes of each kind of value were pushed to stderr on exit.");
+		puts("    --alloc-profile: Count the allocations (GMP's and everything else's) made by each function and builtin, and print them to stderr on exit.");
+		puts("    --profile: Time every call to a function or builtin, and print a profile of them to stderr on exit.");
+		puts("    --trace=<file>: Record every definition, builtin, ffi call, include, stack switch and ref write, and write them to <file> on exit in Chrome's trace event format.");
+		puts("    --trace-filter=<glob>: With --trace, only record definitions whose names match <glob>, and whatever they run.");
+		puts("    --sample-profile=<hz>: Sample which definitions are running <hz> times a second, and print them to stderr on exit as folded stacks (for flamegraphs).");
+		puts("    --dump-state=<file>: Write every stack and ref to <file> on exit, however charm exits.");
+		puts("    --typecheck=<mode>: When to check type signatures at runtime: always (the default), sample:N (every Nth call), or off.");
 	};
 	CommandLineLambda<&args, &helpFlag, &helpF> helpArg;
 	if (helpArg.runArg()) {
@@ -103,6 +185,137 @@ int main(int argc, char const *argv[]) {
 		return -1;
 	}
 
+	static std::optional<std::string> disableOptOpt;
+	static std::string disableOptFlag("--disable-opt");
+	CommandLineOptional<&args, &disableOptFlag, &disableOptOpt> disableOptArg;
+	if (!disableOptArg.runArg()) {
+		return -1;
+	}
+	if (disableOptOpt) {
+		std::stringstream passes(*disableOptOpt);
+		std::string pass;
+		while (std::getline(passes, pass, ',')) {
+			if (!FunctionAnalyzer::setPassEnabled(pass, false)) {
+				std::cout << "Unknown optimization pass " << pass << std::endl;
+				return -1;
+			}
+		}
+	}
+
+	static std::string optReportFlag("--opt-report");
+	static std::function<void()> optReportF = []() {
+		//printed however charm exits, errors included
+		std::atexit([]() {
+			FunctionAnalyzer::printOptimizationReport(std::cerr);
+		});
+	};
+	CommandLineLambda<&args, &optReportFlag, &optReportF> optReportArg;
+	optReportArg.runArg();
+
+	static std::string allocProfileFlag("--alloc-profile");
+	static AllocationProfiler* allocationProfiler = nullptr;
+	static std::function<void()> allocProfileF = []() {
+		allocationProfiler = new AllocationProfiler();
+		std::atexit([]() {
+			allocationProfiler->print(std::cerr);
+		});
+	};
+	CommandLineLambda<&args, &allocProfileFlag, &allocProfileF> allocProfileArg;
+	allocProfileArg.runArg();
+	runner.allocationProfiler = allocationProfiler;
+
+	static std::string statsFlag("--stats");
+	static std::function<void()> statsF = []() {
+		Stack::countPushes = true;
+		std::atexit([]() {
+			std::cerr << "stats:" << std::endl;
+			for (auto& stat : runner.getStats()) {
+				std::cerr << std::setw(16) << stat.second << "  " << stat.first << std::endl;
+			}
+		});
+	};
+	CommandLineLambda<&args, &statsFlag, &statsF> statsArg;
+	statsArg.runArg();
+
+	static std::string profileFlag("--profile");
+	static Profiler* profiler = nullptr;
+	static std::function<void()> profileF = []() {
+		//the runner is gone by the time atexit runs, so the profiler outlives it
+		profiler = new Profiler();
+		std::atexit([]() {
+			profiler->print(std::cerr);
+		});
+	};
+	CommandLineLambda<&args, &profileFlag, &profileF> profileArg;
+	profileArg.runArg();
+	runner.profiler = profiler;
+
+	static std::optional<std::string> sampleProfileOpt;
+	static std::string sampleProfileFlag("--sample-profile");
+	CommandLineValue<&args, &sampleProfileFlag, &sampleProfileOpt> sampleProfileArg;
+	sampleProfileArg.runArg();
+	if (sampleProfileOpt) {
+		const std::string& hz = *sampleProfileOpt;
+		bool ok = !hz.empty() && hz.size() <= 6 && std::all_of(hz.begin(), hz.end(), ::isdigit) && std::stoul(hz) > 0;
+		static SamplingProfiler* sampler = nullptr;
+		if (ok) {
+			sampler = new SamplingProfiler(std::stoul(hz), &ok);
+		}
+		if (!ok) {
+			std::cout << "Can't sample " << hz << " times a second" << std::endl;
+			return -1;
+		}
+		std::atexit([]() {
+			sampler->print(std::cerr);
+		});
+		runner.sampler = sampler;
+	}
+
+	static std::optional<std::string> traceOpt;
+	static std::string traceFlag("--trace");
+	CommandLineValue<&args, &traceFlag, &traceOpt> traceArg;
+	traceArg.runArg();
+	static std::optional<std::string> traceFilterOpt;
+	static std::string traceFilterFlag("--trace-filter");
+	CommandLineValue<&args, &traceFilterFlag, &traceFilterOpt> traceFilterArg;
+	traceFilterArg.runArg();
+	if (traceOpt) {
+		static Tracer* tracer = new Tracer(traceFilterOpt ? *traceFilterOpt : "");
+		std::atexit([]() {
+			std::ofstream traceFile(*traceOpt);
+			if (!traceFile) {
+				std::cerr << "Couldn't write the trace to " << *traceOpt << std::endl;
+				return;
+			}
+			tracer->write(traceFile);
+		});
+		runner.tracer = tracer;
+	}
+
+	static std::optional<std::string> dumpStateOpt;
+	static std::string dumpStateFlag("--dump-state");
+	CommandLineValue<&args, &dumpStateFlag, &dumpStateOpt> dumpStateArg;
+	dumpStateArg.runArg();
+	if (dumpStateOpt) {
+		std::atexit([]() {
+			std::ofstream stateFile(*dumpStateOpt);
+			if (!stateFile) {
+				std::cerr << "Couldn't write the state to " << *dumpStateOpt << std::endl;
+				return;
+			}
+			runner.writeState(stateFile);
+		});
+	}
+
+	static std::optional<std::string> typeCheckOpt;
+	static std::string typeCheckFlag("--typecheck");
+	CommandLineValue<&args, &typeCheckFlag, &typeCheckOpt> typeCheckArg;
+	typeCheckArg.runArg();
+	if (typeCheckOpt && !runner.setTypeCheckMode(*typeCheckOpt)) {
+		std::cout << "Unknown type check mode " << *typeCheckOpt << std::endl;
+		return -1;
+	}
+
 	static std::optional<std::string> interactiveFileOpt;
 	static std::string interactiveFileFlag("-f");
 	CommandLineOptional<&args, &interactiveFileFlag, &interactiveFileOpt> interactiveFileArg;
@@ -110,14 +323,66 @@ int main(int argc, char const *argv[]) {
 		return -1;
 	}
 
+	static std::optional<std::string> filterProgramOpt;
+	static std::string filterProgramFlag("-n");
+	CommandLineOptional<&args, &filterProgramFlag, &filterProgramOpt> filterProgramArg;
+	if (!filterProgramArg.runArg()) {
+		return -1;
+	}
+	if (filterProgramOpt) {
+		return runRecordFilter(parser, runner, *filterProgramOpt, false);
+	}
+
+	static std::optional<std::string> printProgramOpt;
+	static std::string printProgramFlag("-p");
+	CommandLineOptional<&args, &printProgramFlag, &printProgramOpt> printProgramArg;
+	if (!printProgramArg.runArg()) {
+		return -1;
+	}
+	if (printProgramOpt) {
+		return runRecordFilter(parser, runner, *printProgramOpt, true);
+	}
+
+	static bool streamMode = false;
+	static std::string streamFlag("--stream");
+	static std::function<void()> streamF = []() {
+		streamMode = true;
+	};
+	CommandLineLambda<&args, &streamFlag, &streamF> streamArg;
+	streamArg.runArg();
+
 	//parse input file
 	std::optional<std::string> optFileName;
 	if (args.size() > 0) {
 		optFileName = args.back();
 	}
+	if (optFileName && *optFileName == "-") {
+		streamMode = true;
+	}
 
+	if (streamMode) {
+		//run a program that's piped in. each line is run as soon as it's read
+		//and then thrown away, so this works on programs that never end
+		try {
+			runner.run(parser.lex(prelude));
+		} catch (std::exception &e) {
+			printf("Prelude.charm nonexistant or unopenable. This shouldn't ever happen! Please report it to the charm devs.\n");
+			printf("Error: %s\n\n", e.what());
+			return -1;
+		}
+		try {
+			std::string line;
+			while (std::getline(std::cin, line)) {
+				runner.run(parser.lex(line));
+				//whatever's reading our output shouldn't have to wait for the next line
+				std::cout.flush();
+			}
+		} catch (std::exception &e) {
+			printf("Error while running stdin: %s\n", e.what());
+			return -1;
+		}
 	//if theres a file to run, load it and run it
-	if (optFileName) {
+	} else if (optFileName) {
 		//first, load the prelude
 		try {
 			//load up the Prelude.charm file
@@ -128,10 +393,15 @@ int main(int argc, char const *argv[]) {
 			return -1;
 		}
 		try {
-			std::string line;
 			std::ifstream inFile(*optFileName);
-			while (std::getline(inFile, line)) {
-				runner.run(parser.lex(line));
+			std::stringstream inFileContents;
+			inFileContents << inFile.rdbuf();
+			for (auto& line : parser.prelex(inFileContents.str())) {
+				runner.run(parser.lexPrelexed(line));
+			}
+			if (analyzeFunctionOpt) {
+				std::cout.flush();
+				parser.getFunctionAnalyzer()->printAnalysis(*analyzeFunctionOpt, std::cout);
 			}
 		} catch (std::exception &e) {
 			printf("%s nonexistant or unopenable.\n", (*optFileName).c_str());
@@ -154,10 +424,11 @@ int main(int argc, char const *argv[]) {
 		try {
 			//if one was supplied, load up an extra interactive file
 			if (interactiveFileOpt) {
-				std::string line;
 				std::ifstream interactiveFile(*interactiveFileOpt);
-				while (std::getline(interactiveFile, line)) {
-					runner.run(parser.lex(line));
+				std::stringstream interactiveFileContents;
+				interactiveFileContents << interactiveFile.rdbuf();
+				for (auto& line : parser.prelex(interactiveFileContents.str())) {
+					runner.run(parser.lexPrelexed(line));
 				}
 				printf("%s loaded.\n", (*interactiveFileOpt).c_str());
 			}
@@ -180,7 +451,9 @@ int main(int argc, char const *argv[]) {
 #else
 			std::string codeInput;
 			std::cout << prompt.str();
-			std::cin >> codeInput;
+			if (!std::getline(std::cin, codeInput)) {
+				break;
+			}
 #endif
 			try {
 				auto parsedProgram = parser.lex(codeInput);
@@ -0,0 +1,152 @@
+//the lexer test, built and run by `make test`. a program is lexed line by line with
+//Parser::lex, then with Parser::prelex and lexPrelexed on more threads than there are cores
+//and with chunks small enough to split every run of related lines (type signature, memo,
+//definition, code that calls it) across threads. everything lexPrelexed hands back and every
+//error it prints has to be exactly what lex did. prelex itself can't print anything, and has
+//to leave quietErrors on the calling thread the way it found it
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+
+#include "../../Parser.h"
+#include "../../Error.h"
+
+//every kind of line prelexLine handles, and the ones it leaves for lexPrelexed
+static std::string program(unsigned long copies) {
+	std::stringstream out;
+	for (unsigned long n = 0; n < copies; n++) {
+		std::string i = std::to_string(n);
+		out << "sq" << i << " :: int -> int" << std::endl;
+		out << "memo sq" << i << std::endl;
+		out << "sq" << i << " := dup *" << std::endl;
+		out << "plus" << i << " := sq" << i << " " << i << " +" << std::endl;
+		out << "loop" << i << " := [ dup ] [ 1 - loop" << i << " ] [ ] ifthen" << std::endl;
+		out << i << " plus" << i << " [ plus" << i << " 2 ] i loop" << i << " \" text \" concat" << std::endl;
+		out << "\" not := a definition \" pstring" << std::endl;
+		out << "both" << i << " := 1 \" := \" concat" << std::endl;
+		out << "[ 1 [ 2 3 ] " << i << ".5 ] 0 at" << std::endl;
+		out << "[ 1 2" << std::endl;
+		out << "\" unterminated" << std::endl;
+		out << "bad" << i << " :: int ->" << std::endl;
+		out << std::endl;
+	}
+	return out.str();
+}
+
+//what lexing one line gave: every function (definitions with their bodies and what the
+//analyzer decided about them), or the error
+static std::string describe(const CHARM_LIST_TYPE& code) {
+	std::stringstream out;
+	for (const CharmFunction& f : code) {
+		out << charmFunctionToString(f);
+		if (f.functionType == FUNCTION_DEFINITION) {
+			out << " (inlineable " << f.definitionInfo.inlineable << ", tail call " << f.definitionInfo.tailCallRecursive << ")";
+		}
+		if (f.functionType == DEFINED_FUNCTION && !f.typeChecked) {
+			out << " (unchecked)";
+		}
+		out << " ";
+	}
+	return out.str();
+}
+
+//runs `lexLines` with everything it prints to std::cout going into what it returns
+template <typename F>
+static std::string captureOutput(F lexLines) {
+	std::stringstream captured;
+	std::streambuf* original = std::cout.rdbuf(captured.rdbuf());
+	lexLines();
+	std::cout.rdbuf(original);
+	return captured.str();
+}
+
+static std::string lexSerially(const std::string& input) {
+	Parser parser;
+	return captureOutput([&]() {
+		std::stringstream lines(input);
+		std::string line;
+		while (std::getline(lines, line, '\n')) {
+			try {
+				std::cout << describe(parser.lex(line).first) << std::endl;
+			} catch (std::runtime_error& e) {
+				std::cout << "error: " << e.what() << std::endl;
+			}
+		}
+	});
+}
+
+static unsigned int failures = 0;
+static void check(bool ok, const std::string& what) {
+	if (!ok) {
+		std::cerr << "FAIL " << what << std::endl;
+		failures++;
+	}
+}
+
+static void checkPrelexed(const std::string& input, const std::string& expected, PrelexOptions options, bool startQuiet) {
+	std::string name = std::to_string(options.threadCount) + " threads, chunks of " + std::to_string(options.chunkSize) +
+		(startQuiet ? ", quiet errors" : "");
+	Parser parser;
+	std::vector<PrelexedLine> lines;
+	setQuietErrors(startQuiet);
+	std::string printed = captureOutput([&]() {
+		lines = parser.prelex(input, options);
+	});
+	check(quietErrors == startQuiet, name + ": prelex changed quietErrors");
+	setQuietErrors(false);
+	check(printed.empty(), name + ": prelex printed " + printed);
+	unsigned long prelexed = 0;
+	for (const PrelexedLine& line : lines) {
+		prelexed += line.kind != PrelexedLine::RAW_LINE;
+	}
+	check(prelexed > 0, name + ": no line was lexed ahead of time");
+	std::string got = captureOutput([&]() {
+		for (PrelexedLine& line : lines) {
+			try {
+				std::cout << describe(parser.lexPrelexed(line).first) << std::endl;
+			} catch (std::runtime_error& e) {
+				std::cout << "error: " << e.what() << std::endl;
+			}
+		}
+	});
+	if (got != expected) {
+		std::stringstream gotLines(got);
+		std::stringstream expectedLines(expected);
+		std::string gotLine, expectedLine;
+		for (unsigned long n = 1; std::getline(expectedLines, expectedLine); n++) {
+			std::getline(gotLines, gotLine);
+			if (gotLine != expectedLine) {
+				check(false, name + ": line " + std::to_string(n) + " is `" + gotLine + "`, lex gave `" + expectedLine + "`");
+				break;
+			}
+		}
+		check(false, name + ": lexPrelexed didn't match lex");
+	}
+}
+
+int main() {
+	std::string input = program(40);
+	std::string expected = lexSerially(input);
+	for (unsigned long chunkSize : { 1ul, 2ul, 3ul, 7ul, 13ul, 64ul }) {
+		for (unsigned int threadCount : { 2u, 4u }) {
+			PrelexOptions options;
+			options.threshold = 0;
+			options.threadCount = threadCount;
+			options.chunkSize = chunkSize;
+			checkPrelexed(input, expected, options, false);
+		}
+	}
+	PrelexOptions options;
+	options.threshold = 0;
+	options.threadCount = 3;
+	options.chunkSize = 5;
+	checkPrelexed(input, expected, options, true);
+	if (failures > 0) {
+		std::cerr << failures << " lexer checks failed." << std::endl;
+		return 1;
+	}
+	std::cout << "prelex matches lex on every thread count and chunk size." << std::endl;
+	return 0;
+}
@@ -0,0 +1,90 @@
+#!/usr/bin/env ruby
+# Runs the behavior tests. every test/<dir>/<name>.charm with a <name>.out next to it is a test:
+# it's run with ../charm from its own directory, and everything it prints has to match
+# <name>.out. a test can also have
+#
+#   <name>.flags   flags to run charm with (before the file), all on one line. if the last one
+#                  is -n or -p, <name>.charm is the one line program that goes after it instead
+#   <name>.in      what it reads from stdin, otherwise it reads nothing
+#   <name>.state   what --dump-state has to write once it exits
+#
+# every test is run twice with the same fresh CHARM_CACHE_DIR, so that anything it includes
+# comes from the disk cache the second time, and has to behave the same.
+#
+#   ruby run-tests.rb [--charm=PATH] [NAME...]   runs the tests with NAME in their path, or all of them
+
+require "open3"
+require "tmpdir"
+require "timeout"
+
+charm = File.expand_path("../charm", __dir__)
+filters = []
+ARGV.each do |arg|
+    if arg.start_with?("--charm=")
+        charm = File.expand_path(arg.split("=", 2)[1])
+    else
+        filters << arg
+    end
+end
+unless File.exist?(charm)
+    puts "There's no charm to run at #{charm}, build it with make release first."
+    exit -1
+end
+
+# a lot shorter than anything any of the tests should take
+TIMEOUT = 30
+
+def run(charm, test, env, state_file)
+    flags = File.exist?("#{test}.flags") ? File.read("#{test}.flags").split : []
+    flags.unshift("--dump-state=#{state_file}") if state_file
+    program = File.basename("#{test}.charm")
+    program = File.read("#{test}.charm").strip if ["-n", "-p"].include?(flags.last)
+    input = File.exist?("#{test}.in") ? File.read("#{test}.in") : ""
+    Timeout.timeout(TIMEOUT) do
+        out, _ = Open3.capture2(env, charm, *flags, program,
+            stdin_data: input, chdir: File.dirname(test), err: File::NULL)
+        out
+    end
+rescue Timeout::Error
+    "(timed out after #{TIMEOUT} seconds)"
+end
+
+# the first line where they're different, and what each of them has there
+def difference(expected, got)
+    expected_lines = expected.lines
+    got_lines = got.lines
+    line = (0...[expected_lines.size, got_lines.size].max).find { |n| expected_lines[n] != got_lines[n] }
+    "line #{line + 1}: expected #{(expected_lines[line] || "nothing").inspect}, got #{(got_lines[line] || "nothing").inspect}"
+end
+
+tests = Dir[File.join(__dir__, "*", "*.out")].sort.map { |out| out.chomp(".out") }
+tests.select! { |test| File.exist?("#{test}.charm") }
+tests.select! { |test| filters.any? { |filter| test.include?(filter) } } unless filters.empty?
+failed = []
+tests.each do |test|
+    name = test.delete_prefix("#{__dir__}/")
+    Dir.mktmpdir do |dir|
+        env = { "CHARM_CACHE_DIR" => File.join(dir, "cache") }
+        state_file = File.exist?("#{test}.state") ? File.join(dir, "state") : nil
+        ["", " (cached)"].each do |run_name|
+            File.delete(state_file) if state_file && File.exist?(state_file)
+            got = run(charm, test, env, state_file)
+            expected = File.read("#{test}.out")
+            problem = nil
+            if got != expected
+                problem = "output, #{difference(expected, got)}"
+            elsif state_file
+                got_state = File.exist?(state_file) ? File.read(state_file) : ""
+                expected_state = File.read("#{test}.state")
+                problem = "state, #{difference(expected_state, got_state)}" if got_state != expected_state
+            end
+            if problem
+                puts "FAIL #{name}#{run_name}: #{problem}"
+                failed << name
+                break
+            end
+        end
+    end
+end
+puts "#{tests.size - failed.size} of #{tests.size} tests passed."
+exit(failed.empty? ? 0 : 1)